@@ -23,7 +23,7 @@
 #include "crc.h"
 #include "string.h"
 
-std::wstring ConvertCrcValueToString(ULONG crc) {
+std::wstring ConvertCrcValueToString(unsigned long crc) {
   wchar_t crc_val[16] = {0};
   _ultow_s(crc, crc_val, 16, 16);
 
@@ -70,4 +70,8 @@ std::wstring CalculateCrcFromString(const std::wstring& str) {
   crc = crc32(crc, reinterpret_cast<const Bytef*>(text.data()), text.size());
 
   return ConvertCrcValueToString(crc);
+}
+
+unsigned long UpdateCrc(unsigned long crc, const void* data, size_t size) {
+  return crc32(crc, reinterpret_cast<const Bytef*>(data), size);
 }
\ No newline at end of file
@@ -24,4 +24,8 @@
 std::wstring CalculateCrcFromFile(const std::wstring& file);
 std::wstring CalculateCrcFromString(const std::wstring& str);
 
+// Used for data that arrives in parts, starting with a CRC of 0
+unsigned long UpdateCrc(unsigned long crc, const void* data, size_t size);
+std::wstring ConvertCrcValueToString(unsigned long crc);
+
 #endif // TAIGA_BASE_CRC_H
\ No newline at end of file
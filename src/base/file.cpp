@@ -19,6 +19,7 @@
 #include <fstream>
 #include <shlobj.h>
 
+#include "crc.h"
 #include "file.h"
 #include "string.h"
 #include "win/win_registry.h"
@@ -313,7 +314,8 @@ int PopulateFolders(std::vector<std::wstring>& folder_list,
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool ReadFromFile(const std::wstring& path, std::string& output) {
+bool ReadFromFile(const std::wstring& path, std::string& output,
+                  size_t max_length) {
   std::ifstream is;
   is.open(WstrToStr(path).c_str(), std::ios::binary);
 
@@ -321,6 +323,8 @@ bool ReadFromFile(const std::wstring& path, std::string& output) {
   size_t len = static_cast<size_t>(is.tellg());
 
   if (len != -1) {
+    if (max_length && len > max_length)
+      len = max_length;
     output.resize(len);
     is.seekg(0, std::ios::beg);
     is.read((char*)output.data(), output.size());
@@ -379,4 +383,153 @@ std::wstring ToSizeString(QWORD qwSize) {
   }
 
   return size + unit;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Enough to tell a file apart from e.g. an error page
+const size_t kFileHeadSize = 256;
+
+AtomicFileWriter::AtomicFileWriter()
+    : crc_(0),
+      handle_(INVALID_HANDLE_VALUE),
+      size_(0) {
+}
+
+// Copies do not share the file handle, they are created closed instead
+AtomicFileWriter::AtomicFileWriter(const AtomicFileWriter&)
+    : crc_(0),
+      handle_(INVALID_HANDLE_VALUE),
+      size_(0) {
+}
+
+AtomicFileWriter::~AtomicFileWriter() {
+  Discard();
+}
+
+AtomicFileWriter& AtomicFileWriter::operator=(const AtomicFileWriter&) {
+  Discard();
+  return *this;
+}
+
+bool AtomicFileWriter::Open(const std::wstring& path, bool resume) {
+  Discard();
+
+  // Make sure the path is available
+  CreateFolder(GetPathOnly(path));
+
+  path_ = path;
+  temp_path_ = GetPartialPath(path);
+
+  if (!resume) {
+    handle_ = OpenFileForGenericWrite(temp_path_);
+    return handle_ != INVALID_HANDLE_VALUE;
+  }
+
+  // Continue after the data that was written before, which has to be read
+  // once to calculate its CRC
+  handle_ = ::CreateFile(GetExtendedLengthPath(temp_path_).c_str(),
+                         GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (handle_ == INVALID_HANDLE_VALUE)
+    return false;
+
+  BYTE buffer[0x10000];
+  DWORD bytes_read = 0;
+  while (::ReadFile(handle_, buffer, sizeof(buffer), &bytes_read, nullptr) &&
+         bytes_read) {
+    crc_ = UpdateCrc(crc_, buffer, bytes_read);
+    if (head_.size() < kFileHeadSize)
+      head_.append(reinterpret_cast<const char*>(buffer),
+                   min(kFileHeadSize - head_.size(),
+                       static_cast<size_t>(bytes_read)));
+    size_ += bytes_read;
+  }
+
+  return true;
+}
+
+bool AtomicFileWriter::Write(const void* data, size_t size) {
+  if (handle_ == INVALID_HANDLE_VALUE)
+    return false;
+
+  DWORD bytes_written = 0;
+  if (!::WriteFile(handle_, data, static_cast<DWORD>(size), &bytes_written,
+                   nullptr) || bytes_written != size)
+    return false;
+
+  crc_ = UpdateCrc(crc_, data, size);
+  if (head_.size() < kFileHeadSize)
+    head_.append(static_cast<const char*>(data),
+                 min(kFileHeadSize - head_.size(), size));
+  size_ += size;
+
+  return true;
+}
+
+bool AtomicFileWriter::Commit() {
+  if (handle_ == INVALID_HANDLE_VALUE)
+    return false;
+
+  ::CloseHandle(handle_);
+  handle_ = INVALID_HANDLE_VALUE;
+
+  BOOL result = ::MoveFileEx(GetExtendedLengthPath(temp_path_).c_str(),
+                             GetExtendedLengthPath(path_).c_str(),
+                             MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+  if (!result)
+    ::DeleteFile(GetExtendedLengthPath(temp_path_).c_str());
+
+  return result != FALSE;
+}
+
+void AtomicFileWriter::Discard() {
+  if (handle_ != INVALID_HANDLE_VALUE) {
+    ::CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+    ::DeleteFile(GetExtendedLengthPath(temp_path_).c_str());
+  }
+
+  crc_ = 0;
+  head_.clear();
+  size_ = 0;
+}
+
+void AtomicFileWriter::Suspend() {
+  if (handle_ != INVALID_HANDLE_VALUE) {
+    ::CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+  }
+
+  crc_ = 0;
+  head_.clear();
+  size_ = 0;
+}
+
+std::wstring AtomicFileWriter::GetPartialPath(const std::wstring& path) {
+  return path + L".part";
+}
+
+std::wstring AtomicFileWriter::checksum() const {
+  return ConvertCrcValueToString(crc_);
+}
+
+const std::string& AtomicFileWriter::head() const {
+  return head_;
+}
+
+bool AtomicFileWriter::is_open() const {
+  return handle_ != INVALID_HANDLE_VALUE;
+}
+
+const std::wstring& AtomicFileWriter::path() const {
+  return path_;
+}
+
+QWORD AtomicFileWriter::size() const {
+  return size_;
+}
+
+void AtomicFileWriter::set_path(const std::wstring& path) {
+  path_ = path;
 }
\ No newline at end of file
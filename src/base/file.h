@@ -54,12 +54,50 @@ std::wstring GetDefaultAppPath(const std::wstring& extension, const std::wstring
 unsigned int PopulateFiles(std::vector<std::wstring>& file_list, const std::wstring& path, const std::wstring& extension = L"", bool recursive = false, bool trim_extension = false);
 int PopulateFolders(std::vector<std::wstring>& folder_list, const std::wstring& path);
 
-bool ReadFromFile(const std::wstring& path, std::string& output);
+bool ReadFromFile(const std::wstring& path, std::string& output, size_t max_length = 0);
 bool SaveToFile(LPCVOID data, DWORD length, const std::wstring& path, bool take_backup = false);
 bool SaveToFile(const std::string& data, const std::wstring& path, bool take_backup = false);
 
 std::wstring ToSizeString(QWORD qwSize);
 
+// Writes to a temporary file next to the target, which replaces the target
+// only when it is committed. A write that fails or is discarded halfway never
+// leaves a partial file behind, unless it is suspended to be resumed later.
+// The CRC of the data is calculated on the fly, and the beginning of the data
+// is kept so that the file can be validated before it is committed.
+class AtomicFileWriter {
+public:
+  AtomicFileWriter();
+  AtomicFileWriter(const AtomicFileWriter&);
+  ~AtomicFileWriter();
+
+  AtomicFileWriter& operator=(const AtomicFileWriter&);
+
+  bool Open(const std::wstring& path, bool resume = false);
+  bool Write(const void* data, size_t size);
+  bool Commit();
+  void Discard();
+  void Suspend();
+
+  static std::wstring GetPartialPath(const std::wstring& path);
+
+  std::wstring checksum() const;
+  const std::string& head() const;
+  bool is_open() const;
+  const std::wstring& path() const;
+  QWORD size() const;
+  // The target can be changed until the file is committed
+  void set_path(const std::wstring& path);
+
+private:
+  unsigned long crc_;
+  HANDLE handle_;
+  std::string head_;
+  std::wstring path_;
+  QWORD size_;
+  std::wstring temp_path_;
+};
+
 class FileSearchHelper {
 public:
   typedef std::function<bool(const std::wstring& root, const std::wstring& name, const WIN32_FIND_DATA& data)> callback_function_t;
@@ -22,6 +22,110 @@
 
 #include "gzip.h"
 
+// Output is inflated directly into the end of the buffer, in chunks of this
+// size
+const size_t kInflateChunkSize = 16 * 1024;  // 16 KiB
+
+GzipInflater::GzipInflater()
+    : finished_(false), stream_(nullptr) {
+}
+
+GzipInflater::GzipInflater(const GzipInflater& inflater)
+    : finished_(false), stream_(nullptr) {
+  // Stream state is not copied
+}
+
+GzipInflater::~GzipInflater() {
+  End();
+}
+
+GzipInflater& GzipInflater::operator=(const GzipInflater& inflater) {
+  End();
+  return *this;
+}
+
+void GzipInflater::Reset() {
+  if (stream_)
+    inflateReset(stream_);
+  finished_ = false;
+}
+
+bool GzipInflater::Write(const char* data, size_t size, std::string& output) {
+  if (!Initialize())
+    return false;
+
+  // Anything after the end of the stream is ignored
+  if (finished_)
+    return true;
+
+  stream_->next_in = (Bytef*)data;
+  stream_->avail_in = size;
+
+  while (true) {
+    size_t offset = output.size();
+    output.resize(offset + kInflateChunkSize);
+    stream_->next_out = (Bytef*)&output[offset];
+    stream_->avail_out = kInflateChunkSize;
+
+    int status = inflate(stream_, Z_NO_FLUSH);
+    output.resize(output.size() - stream_->avail_out);
+
+    switch (status) {
+      case Z_STREAM_END:
+        finished_ = true;
+        return true;
+      case Z_BUF_ERROR:  // Needs more input
+        return stream_->avail_in == 0;
+      case Z_OK:
+        if (stream_->avail_in == 0 && stream_->avail_out > 0)
+          return true;
+        break;
+      default:
+        return false;
+    }
+  }
+}
+
+bool GzipInflater::finished() const {
+  return finished_;
+}
+
+bool GzipInflater::started() const {
+  return stream_ && stream_->total_in > 0;
+}
+
+bool GzipInflater::Initialize() {
+  if (stream_)
+    return true;
+
+  stream_ = new z_stream;
+  stream_->zalloc = Z_NULL;
+  stream_->zfree = Z_NULL;
+  stream_->opaque = Z_NULL;
+  stream_->next_in = Z_NULL;
+  stream_->avail_in = 0;
+
+  // Adding 32 to window bits enables automatic gzip header detection
+  if (inflateInit2(stream_, MAX_WBITS + 32) != Z_OK) {
+    delete stream_;
+    stream_ = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+void GzipInflater::End() {
+  if (stream_) {
+    inflateEnd(stream_);
+    delete stream_;
+    stream_ = nullptr;
+  }
+  finished_ = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool UncompressGzippedFile(const std::string& file, std::string& output) {
   gzFile gzfile = gzopen(file.c_str(), "rb");
 
@@ -78,6 +182,32 @@ bool UncompressGzippedString(const std::string& input, std::string& output) {
   return status == Z_STREAM_END;
 }
 
+bool GzipString(const std::string& input, std::string& output) {
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = NULL;
+
+  // Adding 16 to window bits produces a gzip header and trailer
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+
+  output.resize(deflateBound(&stream, input.length()));
+
+  stream.next_in = (BYTE*)input.data();
+  stream.avail_in = input.length();
+  stream.next_out = (BYTE*)&output[0];
+  stream.avail_out = output.length();
+
+  int status = deflate(&stream, Z_FINISH);
+
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+
+  return status == Z_STREAM_END;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 bool DeflateString(const std::string& input, std::string& output) {
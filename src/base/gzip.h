@@ -21,8 +21,38 @@
 
 #include <string>
 
+struct z_stream_s;
+
+// Decompresses a gzip stream as it arrives, appending the output to a buffer.
+// The stream state (e.g. the window) is kept between streams, and reset
+// rather than reallocated.
+
+class GzipInflater {
+public:
+  GzipInflater();
+  GzipInflater(const GzipInflater& inflater);
+  ~GzipInflater();
+
+  GzipInflater& operator=(const GzipInflater& inflater);
+
+  void Reset();
+  bool Write(const char* data, size_t size, std::string& output);
+
+  // A stream that has started but not finished is truncated
+  bool finished() const;
+  bool started() const;
+
+private:
+  bool Initialize();
+  void End();
+
+  bool finished_;
+  z_stream_s* stream_;
+};
+
 bool UncompressGzippedFile(const std::string& file, std::string& output);
 bool UncompressGzippedString(const std::string& input, std::string& output);
+bool GzipString(const std::string& input, std::string& output);
 
 bool DeflateString(const std::string& input, std::string& output);
 bool InflateString(const std::string& input, std::string& output, size_t output_length);
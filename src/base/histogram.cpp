@@ -0,0 +1,123 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "histogram.h"
+
+// Values below the sub-bucket count are recorded exactly. Each power of two
+// above that is split into half as many sub-buckets.
+const unsigned int kSubBucketBits = 5;
+const unsigned int kSubBucketCount = 1 << kSubBucketBits;
+const unsigned int kSubBucketHalfCount = kSubBucketCount / 2;
+
+Histogram::Histogram()
+    : count_(0),
+      max_(0),
+      min_(0),
+      sum_(0) {
+}
+
+void Histogram::Clear() {
+  counts_.clear();
+  count_ = 0;
+  max_ = 0;
+  min_ = 0;
+  sum_ = 0;
+}
+
+void Histogram::Record(QWORD value) {
+  // Buckets are only allocated up to the highest value that was recorded
+  size_t index = GetIndex(value);
+  if (index >= counts_.size())
+    counts_.resize(index + 1, 0);
+  counts_[index]++;
+
+  if (!count_ || value < min_)
+    min_ = value;
+  if (value > max_)
+    max_ = value;
+
+  count_++;
+  sum_ += value;
+}
+
+QWORD Histogram::GetPercentile(double percentile) const {
+  if (!count_)
+    return 0;
+
+  if (percentile > 100.0)
+    percentile = 100.0;
+
+  QWORD target = static_cast<QWORD>(percentile / 100.0 * count_ + 0.5);
+  if (target < 1)
+    target = 1;
+
+  QWORD total = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    total += counts_[i];
+    if (total >= target) {
+      QWORD value = GetHighestEquivalentValue(i);
+      return value < max_ ? value : max_;
+    }
+  }
+
+  return max_;
+}
+
+QWORD Histogram::count() const {
+  return count_;
+}
+
+QWORD Histogram::highest() const {
+  return max_;
+}
+
+QWORD Histogram::lowest() const {
+  return min_;
+}
+
+double Histogram::mean() const {
+  return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t Histogram::GetIndex(QWORD value) const {
+  if (value < kSubBucketCount)
+    return static_cast<size_t>(value);
+
+  unsigned int msb = kSubBucketBits;
+  while (msb < 63 && (value >> (msb + 1)))
+    msb++;
+
+  unsigned int shift = msb - kSubBucketBits + 1;
+  size_t sub_bucket = static_cast<size_t>(value >> shift);
+
+  return kSubBucketCount + (msb - kSubBucketBits) * kSubBucketHalfCount +
+         (sub_bucket - kSubBucketHalfCount);
+}
+
+QWORD Histogram::GetHighestEquivalentValue(size_t index) const {
+  if (index < kSubBucketCount)
+    return index;
+
+  size_t offset = index - kSubBucketCount;
+  unsigned int shift = static_cast<unsigned int>(offset / kSubBucketHalfCount) + 1;
+  QWORD sub_bucket = kSubBucketHalfCount + offset % kSubBucketHalfCount;
+
+  return ((sub_bucket + 1) << shift) - 1;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_HISTOGRAM_H
+#define TAIGA_BASE_HISTOGRAM_H
+
+#include <vector>
+
+#include "types.h"
+
+// Records values in log-linear buckets, in the manner of HdrHistogram. Each
+// power of two is split into linear sub-buckets, so that percentiles are
+// reported within a fixed relative precision (6.25%), while memory use does not
+// depend on the number of values.
+
+class Histogram {
+public:
+  Histogram();
+
+  void Clear();
+  void Record(QWORD value);
+
+  QWORD GetPercentile(double percentile) const;
+
+  QWORD count() const;
+  QWORD highest() const;
+  QWORD lowest() const;
+  double mean() const;
+
+private:
+  size_t GetIndex(QWORD value) const;
+  QWORD GetHighestEquivalentValue(size_t index) const;
+
+  std::vector<QWORD> counts_;
+  QWORD count_;
+  QWORD max_;
+  QWORD min_;
+  QWORD sum_;
+};
+
+#endif  // TAIGA_BASE_HISTOGRAM_H
\ No newline at end of file
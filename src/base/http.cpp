@@ -18,13 +18,34 @@
 
 #include "file.h"
 #include "http.h"
+#include "http_share.h"
+#include "http_transport.h"
 #include "string.h"
 
 namespace base {
 namespace http {
 
+const long kDefaultConnectTimeout = 30;  // seconds
+const long kDefaultIdleTimeout = 60;     // seconds
+
+CancellationToken::CancellationToken()
+    : cancelled_(new LONG(0)) {
+}
+
+void CancellationToken::Cancel() {
+  ::InterlockedExchange(cancelled_.get(), 1);
+}
+
+bool CancellationToken::cancelled() const {
+  return *cancelled_ != 0;
+}
+
 Request::Request()
-    : method(L"GET"), parameter(0) {
+    : method(L"GET"),
+      parameter(0),
+      connect_timeout(kDefaultConnectTimeout),
+      idle_timeout(kDefaultIdleTimeout),
+      timeout(0) {
   // Each HTTP request must have a unique ID, as there are many parts of the
   // application that rely on this assumption.
   static unsigned int counter = 0;
@@ -33,7 +54,7 @@ Request::Request()
 }
 
 Response::Response()
-    : code(0), parameter(0) {
+    : code(0), parameter(0), wide_body_decoded_(false) {
 }
 
 void Request::Clear() {
@@ -41,12 +62,29 @@ void Request::Clear() {
   url.Clear();
   header.clear();
   body.clear();
+  cancellation_token = CancellationToken();
+  connect_timeout = kDefaultConnectTimeout;
+  idle_timeout = kDefaultIdleTimeout;
+  timeout = 0;
 }
 
 void Response::Clear() {
   code = 0;
   header.clear();
   body.clear();
+  file.clear();
+  file_checksum.clear();
+  wide_body_.clear();
+  wide_body_decoded_ = false;
+}
+
+const std::wstring& Response::GetWideBody() const {
+  if (!wide_body_decoded_) {
+    wide_body_ = StrToWstr(body);
+    wide_body_decoded_ = true;
+  }
+
+  return wide_body_;
 }
 
 Client::Client(const Request& request)
@@ -59,16 +97,29 @@ Client::Client(const Request& request)
       current_length_(0),
       curl_handle_(nullptr),
       header_list_(nullptr),
+      range_start_(-1),
       request_(request),
+      resume_offset_(0),
       user_agent_(L"Mozilla/5.0") {
 }
 
 Client::~Client() {
+#ifdef TAIGA_HTTP_MULTITHREADED
+  if (busy_)
+    transport_.Remove(this);
+#endif
+
   Cleanup(false);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void Client::ShutdownTransport() {
+#ifdef TAIGA_HTTP_MULTITHREADED
+  transport_.Shutdown();
+#endif
+}
+
 void Client::Cancel() {
   cancel_ = true;
 }
@@ -98,15 +149,25 @@ void Client::Cleanup(bool reuse) {
   response_.Clear();
 
   // Clear buffers
+  download_file_.Discard();
+  download_path_.clear();
   optional_data_.clear();
+  resume_path_.clear();
+  validator_.clear();
   write_buffer_.clear();
 
   // Reset variables
-  busy_ = false;
   cancel_ = false;
   content_encoding_ = kContentEncodingNone;
   content_length_ = 0;
   current_length_ = 0;
+  gzip_inflater_.Reset();
+  range_start_ = -1;
+  resume_offset_ = 0;
+
+  // Must be the last, as the owner may reuse or destroy an idle client from
+  // another thread
+  busy_ = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -135,6 +196,15 @@ curl_off_t Client::current_length() const {
   return current_length_;
 }
 
+double Client::GetTransferInfo(CURLINFO info) const {
+  double value = 0.0;
+
+  if (curl_handle_)
+    curl_easy_getinfo(curl_handle_, info, &value);
+
+  return value;
+}
+
 void Client::set_allow_reuse(bool allow) {
   allow_reuse_ = allow;
 }
@@ -143,6 +213,10 @@ void Client::set_auto_redirect(bool enabled) {
   auto_redirect_ = enabled;
 }
 
+void Client::set_download_path(const std::wstring& path) {
+  download_path_ = path;
+}
+
 void Client::set_proxy(const std::wstring& host,
                        const std::wstring& username,
                        const std::wstring& password) {
@@ -162,6 +236,9 @@ void Client::set_user_agent(const std::wstring& user_agent) {
 ////////////////////////////////////////////////////////////////////////////////
 
 CurlGlobal Client::curl_global_;
+// Must be defined after curl_global_, so that they are destroyed before it
+Share Client::share_;
+Transport Client::transport_;
 
 CurlGlobal::CurlGlobal()
     : initialized_(false) {
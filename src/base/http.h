@@ -19,7 +19,8 @@
 #ifndef TAIGA_BASE_HTTP_H
 #define TAIGA_BASE_HTTP_H
 
-// Each client will have its own thread
+// Transfers are made on the shared I/O thread of the transport, and finished
+// on its dispatch thread
 #define TAIGA_HTTP_MULTITHREADED
 
 #ifdef _DEBUG
@@ -35,11 +36,14 @@
 #endif
 
 #include <windows.h>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <curl/curl.h>
 
+#include "file.h"
+#include "gzip.h"
 #include "map.h"
 #include "url.h"
 #include "win/win_thread.h"
@@ -56,6 +60,19 @@ enum ContentEncoding {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Lets the caller cancel every request that it has made with the same token,
+// e.g. when a dialog is closed. Copies of a token share the same state.
+class CancellationToken {
+public:
+  CancellationToken();
+
+  void Cancel();
+  bool cancelled() const;
+
+private:
+  std::shared_ptr<volatile LONG> cancelled_;
+};
+
 class Request {
 public:
   Request();
@@ -71,6 +88,14 @@ public:
 
   std::wstring uid;
   LPARAM parameter;
+
+  CancellationToken cancellation_token;
+  // In seconds, or 0 for no limit. The transfer is aborted if it cannot
+  // connect in time, if it takes longer than the total, or if nothing is
+  // received for the idle period.
+  long connect_timeout;
+  long idle_timeout;
+  long timeout;
 };
 
 class Response {
@@ -80,17 +105,32 @@ public:
 
   void Clear();
 
+  // Returns the body decoded from UTF-8, which is done only once, on first use
+  const std::wstring& GetWideBody() const;
+
   unsigned int code;
 
   header_t header;
-  std::wstring body;
+  // Holds the body as received, without decoding it
+  std::string body;
+  // The body is written to this file instead, if the client was given a
+  // download path, and the CRC of the file is calculated along the way
+  std::wstring file;
+  std::wstring file_checksum;
 
   std::wstring uid;
   LPARAM parameter;
+
+private:
+  mutable std::wstring wide_body_;
+  mutable bool wide_body_decoded_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
+class Share;
+class Transport;
+
 class CurlGlobal {
 public:
   CurlGlobal();
@@ -104,6 +144,8 @@ private:
 
 class Client : public win::Thread {
 public:
+  friend class Transport;
+
   Client(const Request& request);
   virtual ~Client();
 
@@ -117,9 +159,21 @@ public:
   const Response& response() const;
   curl_off_t content_length() const;
   curl_off_t current_length() const;
+  // Timing and size of the transfer as reported by curl, which are available
+  // until the transfer is finished (i.e. during OnReadComplete)
+  double GetTransferInfo(CURLINFO info) const;
+
+  // Stops the threads that are shared by all clients, before the application
+  // is closed
+  static void ShutdownTransport();
+  // Deletes partial downloads that have not been continued for a while, along
+  // with their validators
+  static void DeleteExpiredPartialFiles(const std::wstring& folder,
+                                        bool recursive = false);
 
   void set_allow_reuse(bool allow);
   void set_auto_redirect(bool enabled);
+  void set_download_path(const std::wstring& path);
   void set_proxy(
       const std::wstring& host,
       const std::wstring& username,
@@ -127,15 +181,31 @@ public:
   void set_referer(const std::wstring& referer);
   void set_user_agent(const std::wstring& user_agent);
 
+  virtual void OnCancel() {}
   virtual void OnError(CURLcode error_code) {}
   virtual bool OnHeadersAvailable() { return false; }
   virtual bool OnProgress() { return false; }
   virtual void OnReadComplete() {}
   virtual bool OnRedirect(const std::wstring& address) { return false; }
+  // Called with the beginning of a finished download, before it replaces the
+  // previous file. Returning false discards it, and cancels the transfer.
+  virtual bool OnValidateDownload(const std::string& head) { return true; }
 
   DWORD ThreadProc();
 
 protected:
+  // Hands the transfer over to the transport, or to a thread of its own when
+  // the transfer is made by Transfer() instead
+  virtual bool SendRequest();
+  // Performs the transfer on the calling thread. A derived class can serve
+  // the response from elsewhere, by passing it to the same callbacks that
+  // curl would call.
+  virtual CURLcode Transfer();
+
+  static size_t HeaderFunction(void*, size_t, size_t, void*);
+  static size_t WriteFunction(char*, size_t, size_t, void*);
+  int ProgressFunction(curl_off_t, curl_off_t);
+
   Request request_;
   Response response_;
 
@@ -146,6 +216,7 @@ protected:
 
   bool allow_reuse_;
   bool auto_redirect_;
+  std::wstring download_path_;
   std::wstring proxy_host_;
   std::wstring proxy_password_;
   std::wstring proxy_username_;
@@ -153,28 +224,39 @@ protected:
   std::wstring user_agent_;
 
 private:
-  static size_t HeaderFunction(void*, size_t, size_t, void*);
-  static size_t WriteFunction(char*, size_t, size_t, void*);
   static int DebugCallback(CURL*, curl_infotype, char*, size_t, void*);
   static int XferInfoFunction(void*, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
-  int ProgressFunction(curl_off_t, curl_off_t);
 
   bool Initialize();
   bool SetRequestOptions();
-  bool SendRequest();
   bool Perform();
+  bool FinishTransfer(CURLcode code);
+
+  bool OpenDownloadFile();
+  void PrepareResume();
 
   void BuildRequestHeader();
   bool GetResponseHeader(const std::wstring& header);
   bool ParseResponseHeader();
 
   static CurlGlobal curl_global_;
+  static Share share_;
+  static Transport transport_;
   CURL* curl_handle_;
 
   bool busy_;
   bool cancel_;
+  AtomicFileWriter download_file_;
+  GzipInflater gzip_inflater_;
   curl_slist* header_list_;
   std::string optional_data_;
+
+  // An interrupted download is continued from its partial file, if the server
+  // can confirm that the file has not changed in the meantime
+  curl_off_t range_start_;
+  curl_off_t resume_offset_;
+  std::wstring resume_path_;
+  std::wstring validator_;
 };
 
 }  // namespace http
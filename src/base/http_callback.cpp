@@ -51,13 +51,39 @@ size_t Client::WriteFunction(char* ptr, size_t size, size_t nmemb,
 
   size_t data_size = size * nmemb;
 
-  reinterpret_cast<std::string*>(userdata)->append(ptr, data_size);
+  auto client = reinterpret_cast<Client*>(userdata);
+
+  // Successful responses are streamed to the download file, if there is one,
+  // while anything else (e.g. an error page) is kept in memory as usual
+  if (!client->download_path_.empty() && !client->download_file_.is_open() &&
+      client->response_.code >= 200 && client->response_.code < 300) {
+    if (!client->OpenDownloadFile())
+      return 0;
+  }
+
+  // Returning a different size aborts the transfer
+  if (client->download_file_.is_open()) {
+    if (client->content_encoding_ == kContentEncodingGzip) {
+      std::string buffer;
+      if (!client->gzip_inflater_.Write(ptr, data_size, buffer) ||
+          !client->download_file_.Write(buffer.data(), buffer.size()))
+        return 0;
+    } else if (!client->download_file_.Write(ptr, data_size)) {
+      return 0;
+    }
+  } else if (client->content_encoding_ == kContentEncodingGzip) {
+    if (!client->gzip_inflater_.Write(ptr, data_size, client->write_buffer_))
+      return 0;
+  } else {
+    client->write_buffer_.append(ptr, data_size);
+  }
 
   return data_size;
 }
 
 int Client::ProgressFunction(curl_off_t dltotal, curl_off_t dlnow) {
-  if (cancel_)
+  // Called at least once per second, even while the transfer is idle
+  if (cancel_ || request_.cancellation_token.cancelled())
     return 1;  // Abort
 
   if (response_.header.empty())
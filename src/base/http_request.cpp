@@ -19,7 +19,7 @@
 #include "file.h"
 #include "foreach.h"
 #include "http.h"
-#include "gzip.h"
+#include "http_share.h"
 #include "log.h"
 #include "string.h"
 #include "url.h"
@@ -27,6 +27,67 @@
 namespace base {
 namespace http {
 
+static std::wstring GetValidatorPath(const std::wstring& path) {
+  return AtomicFileWriter::GetPartialPath(path) + L".info";
+}
+
+static void DeleteValidator(const std::wstring& path) {
+  if (!path.empty())
+    ::DeleteFile(GetExtendedLengthPath(GetValidatorPath(path)).c_str());
+}
+
+static void DeletePartialFile(const std::wstring& path) {
+  ::DeleteFile(GetExtendedLengthPath(
+      AtomicFileWriter::GetPartialPath(path)).c_str());
+  DeleteValidator(path);
+}
+
+// Partial files that are older than this are not worth continuing, as the file
+// has most likely changed on the server, or is not going to be requested again
+const ULONGLONG kPartialFileExpiry = 7 * 24 * 60 * 60;  // seconds
+
+void Client::DeleteExpiredPartialFiles(const std::wstring& folder,
+                                       bool recursive) {
+  const std::wstring partial_extension = AtomicFileWriter::GetPartialPath(L"");
+  const std::wstring validator_extension = GetValidatorPath(L"");
+
+  FILETIME ft_now;
+  ::GetSystemTimeAsFileTime(&ft_now);
+  ULARGE_INTEGER now;
+  now.LowPart = ft_now.dwLowDateTime;
+  now.HighPart = ft_now.dwHighDateTime;
+
+  auto OnFile = [&](const std::wstring& root, const std::wstring& name,
+                    const WIN32_FIND_DATA& data) {
+    std::wstring path;
+    if (EndsWith(name, partial_extension)) {
+      path = name.substr(0, name.size() - partial_extension.size());
+    } else if (EndsWith(name, validator_extension)) {
+      path = name.substr(0, name.size() - validator_extension.size());
+    } else {
+      return false;
+    }
+
+    ULARGE_INTEGER modified;
+    modified.LowPart = data.ftLastWriteTime.dwLowDateTime;
+    modified.HighPart = data.ftLastWriteTime.dwHighDateTime;
+    if (now.QuadPart < modified.QuadPart ||
+        (now.QuadPart - modified.QuadPart) / 10000000 < kPartialFileExpiry)
+      return false;
+
+    LOG(LevelDebug, L"Deleting expired partial file: " +
+                    AddTrailingSlash(root) + name);
+    DeletePartialFile(AddTrailingSlash(root) + path);
+    return false;
+  };
+
+  FileSearchHelper helper;
+  helper.set_skip_subdirectories(!recursive);
+  helper.Search(folder, nullptr, OnFile);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool Client::MakeRequest(const Request& request) {
   // Check if the client is busy
   if (busy_) {
@@ -87,7 +148,7 @@ bool Client::SetRequestOptions() {
   TAIGA_CURL_SET_OPTION(CURLOPT_HEADERDATA, this);
 
   TAIGA_CURL_SET_OPTION(CURLOPT_WRITEFUNCTION, WriteFunction);
-  TAIGA_CURL_SET_OPTION(CURLOPT_WRITEDATA, &write_buffer_);
+  TAIGA_CURL_SET_OPTION(CURLOPT_WRITEDATA, this);
 
   TAIGA_CURL_SET_OPTION(CURLOPT_NOPROGRESS, FALSE);
   TAIGA_CURL_SET_OPTION(CURLOPT_XFERINFOFUNCTION, XferInfoFunction);
@@ -106,6 +167,11 @@ bool Client::SetRequestOptions() {
   TAIGA_CURL_SET_OPTION(CURLOPT_PROTOCOLS, protocols);
   TAIGA_CURL_SET_OPTION(CURLOPT_REDIR_PROTOCOLS, protocols);
 
+  // Share DNS, TLS session and connection caches with other clients
+  CURLSH* share_handle = share_.handle();
+  if (share_handle)
+    TAIGA_CURL_SET_OPTION(CURLOPT_SHARE, share_handle);
+
   // Set proxy
   if (!proxy_host_.empty()) {
     std::string proxy_host = WstrToStr(proxy_host_);
@@ -130,6 +196,16 @@ bool Client::SetRequestOptions() {
     TAIGA_CURL_SET_OPTION(CURLOPT_FOLLOWLOCATION, TRUE);
   }
 
+  // Set timeouts
+  if (request_.connect_timeout > 0)
+    TAIGA_CURL_SET_OPTION(CURLOPT_CONNECTTIMEOUT, request_.connect_timeout);
+  if (request_.timeout > 0)
+    TAIGA_CURL_SET_OPTION(CURLOPT_TIMEOUT, request_.timeout);
+  if (request_.idle_timeout > 0) {
+    TAIGA_CURL_SET_OPTION(CURLOPT_LOW_SPEED_LIMIT, 1L);
+    TAIGA_CURL_SET_OPTION(CURLOPT_LOW_SPEED_TIME, request_.idle_timeout);
+  }
+
   // Set method
   if (request_.method == L"POST") {
     optional_data_ = WstrToStr(request_.body);
@@ -150,6 +226,9 @@ bool Client::SetRequestOptions() {
     TAIGA_CURL_SET_OPTION(CURLOPT_USERAGENT, user_agent.c_str());
   }
 
+  // Continue an interrupted download
+  PrepareResume();
+
   // Set custom headers
   BuildRequestHeader();
   TAIGA_CURL_SET_OPTION(CURLOPT_HTTPHEADER, header_list_);
@@ -169,28 +248,74 @@ bool Client::SetRequestOptions() {
 
 bool Client::SendRequest() {
 #ifdef TAIGA_HTTP_MULTITHREADED
-  return CreateThread(nullptr, 0, 0);
+  return transport_.Add(this);
 #else
-  return Perform();
+  // The callbacks have been called by the time the transfer returns, so the
+  // request counts as sent whatever its result
+  Perform();
+  return true;
 #endif
 }
 
 bool Client::Perform() {
-  CURLcode code = curl_easy_perform(curl_handle_);
+  return FinishTransfer(Transfer());
+}
 
-  if (code == CURLE_OK) {
-    if (!write_buffer_.empty()) {
-      if (content_encoding_ == kContentEncodingGzip) {
-        std::string compressed;
-        std::swap(write_buffer_, compressed);
-        UncompressGzippedString(compressed, write_buffer_);
+bool Client::FinishTransfer(CURLcode code) {
+  // curl reports success if the connection is closed cleanly, even when the
+  // compressed stream has not reached its end
+  if (code == CURLE_OK && content_encoding_ == kContentEncodingGzip &&
+      gzip_inflater_.started() && !gzip_inflater_.finished()) {
+    LOG(LevelWarning, L"Compressed response is truncated.");
+    code = CURLE_WRITE_ERROR;
+  }
+
+  // The download file replaces the previous one only if the transfer succeeded
+  // and what was received is what the client expected
+  if (download_file_.is_open()) {
+    if (code == CURLE_OK && !OnValidateDownload(download_file_.head())) {
+      LOG(LevelDebug, L"Discarding invalid file: " + download_file_.path());
+      download_file_.Discard();
+      DeleteValidator(resume_path_);
+      code = CURLE_ABORTED_BY_CALLBACK;
+    } else if (code == CURLE_OK) {
+      response_.file = download_file_.path();
+      response_.file_checksum = download_file_.checksum();
+      if (!download_file_.Commit()) {
+        LOG(LevelError, L"Could not replace file: " + response_.file);
+        response_.file.clear();
+        response_.file_checksum.clear();
+        code = CURLE_WRITE_ERROR;
       }
-      response_.body = StrToWstr(write_buffer_);
+      DeleteValidator(resume_path_);
+    } else if (code != CURLE_ABORTED_BY_CALLBACK &&
+               code != CURLE_WRITE_ERROR && !validator_.empty()) {
+      // Keep what has been received so far, so that the next request for
+      // the same file can continue from there
+      LOG(LevelDebug, L"Keeping partial file: " + resume_path_ + L" (" +
+                      ToWstr(download_file_.size()) + L" bytes)");
+      download_file_.Suspend();
+    } else {
+      download_file_.Discard();
+      DeleteValidator(resume_path_);
     }
 
+  // The partial file is no longer valid for the requested range
+  } else if (response_.code == 416 && resume_offset_) {
+    DeletePartialFile(resume_path_);
+  }
+
+  if (code == CURLE_OK) {
+    // Compressed bodies have already been inflated as they were received, and
+    // the body is decoded only if it is needed as text
+    std::swap(response_.body, write_buffer_);
+
     OnReadComplete();
 
-  } else if (code != CURLE_ABORTED_BY_CALLBACK) {
+  } else if (code == CURLE_ABORTED_BY_CALLBACK) {
+    OnCancel();
+
+  } else {
     OnError(code);
   }
 
@@ -199,12 +324,100 @@ bool Client::Perform() {
   return code == CURLE_OK;
 }
 
+CURLcode Client::Transfer() {
+  return curl_easy_perform(curl_handle_);
+}
+
 DWORD Client::ThreadProc() {
   return Perform();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void Client::PrepareResume() {
+  resume_path_ = download_path_;
+  resume_offset_ = 0;
+
+  if (download_path_.empty() || request_.header.count(L"Range"))
+    return;
+
+  // A partial file is only continued along with the validator of the
+  // response that it was written from
+  std::string validator;
+  QWORD size = GetFileSize(AtomicFileWriter::GetPartialPath(download_path_));
+  if (!size ||
+      !ReadFromFile(GetValidatorPath(download_path_), validator) ||
+      validator.empty())
+    return;
+
+  resume_offset_ = static_cast<curl_off_t>(size);
+
+  // The server sends the rest of the file only if it has not changed since,
+  // and the whole file otherwise
+  request_.header[L"Range"] = L"bytes=" + ToWstr(size) + L"-";
+  request_.header[L"If-Range"] = StrToWstr(validator);
+  // Ranges refer to the encoded body, while the file holds the decoded one
+  request_.header.erase(L"Accept-Encoding");
+
+  LOG(LevelDebug, L"Resuming download: " + download_path_ + L" (" +
+                  ToWstr(size) + L" bytes)");
+}
+
+bool Client::OpenDownloadFile() {
+  bool resume = false;
+
+  if (response_.code == 206) {
+    if (!resume_offset_ || range_start_ != resume_offset_) {
+      LOG(LevelError, L"Unexpected range: " + ToWstr(range_start_) +
+                      L", expected: " + ToWstr(resume_offset_));
+      DeletePartialFile(resume_path_);
+      return false;
+    }
+    resume = true;
+  } else if (resume_offset_) {
+    // The file has changed on the server, so we start over
+    DeletePartialFile(resume_path_);
+    resume_offset_ = 0;
+  }
+
+  // A redirect may have changed the download path in the meantime, in which
+  // case the partial file is still found under the original one
+  if (!resume)
+    resume_path_ = download_path_;
+
+  if (!download_file_.Open(resume_path_, resume)) {
+    LOG(LevelError, L"Could not open file: " +
+                    AtomicFileWriter::GetPartialPath(resume_path_));
+    DeleteValidator(resume_path_);
+    return false;
+  }
+
+  if (resume &&
+      download_file_.size() != static_cast<QWORD>(resume_offset_)) {
+    LOG(LevelError, L"Partial file has changed: " + resume_path_);
+    download_file_.Discard();
+    DeleteValidator(resume_path_);
+    return false;
+  }
+
+  download_file_.set_path(download_path_);
+
+  // Compressed bodies cannot be continued, as the offset of the encoded body
+  // is not known for the file that holds the decoded one
+  if (content_encoding_ != kContentEncodingNone)
+    validator_.clear();
+
+  if (!validator_.empty()) {
+    SaveToFile(WstrToStr(validator_), GetValidatorPath(resume_path_));
+  } else {
+    DeleteValidator(resume_path_);
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void Client::BuildRequestHeader() {
   // Set acceptable types for the response
   if (!request_.header.count(L"Accept"))
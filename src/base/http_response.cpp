@@ -53,6 +53,8 @@ bool Client::GetResponseHeader(const std::wstring& header) {
 
 bool Client::ParseResponseHeader() {
   Url location;
+  std::wstring etag;
+  std::wstring last_modified;
 
   foreach_(it, response_.header) {
     std::wstring name = it->first;
@@ -66,6 +68,15 @@ bool Client::ParseResponseHeader() {
       }
     } else if (IsEqual(name, L"Content-Length")) {
       content_length_ = ToInt(value);
+    } else if (IsEqual(name, L"Content-Range")) {
+      // e.g. "bytes 1000-1999/2000"
+      range_start_ = _wtoi64(InStr(value, L" ", L"-").c_str());
+    } else if (IsEqual(name, L"ETag")) {
+      // Weak validators cannot be used for range requests
+      if (!StartsWith(value, L"W/"))
+        etag = value;
+    } else if (IsEqual(name, L"Last-Modified")) {
+      last_modified = value;
     } else if (IsEqual(name, L"Location")) {
       if (!OnRedirect(value)) {
         location.Crack(value);
@@ -75,11 +86,15 @@ bool Client::ParseResponseHeader() {
     }
   }
 
+  validator_ = !etag.empty() ? etag : last_modified;
+
   // Redirection
   if (!location.host.empty() && auto_redirect_) {
     content_encoding_ = kContentEncodingNone;
     content_length_ = 0;
     current_length_ = 0;
+    range_start_ = -1;
+    validator_.clear();
     request_.url.host = location.host;
     request_.url.path = location.path;
     response_.Clear();
@@ -0,0 +1,98 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "http_share.h"
+#include "log.h"
+#include "string.h"
+
+namespace base {
+namespace http {
+
+Share::Share()
+    : handle_(nullptr),
+      initialized_(false) {
+}
+
+Share::~Share() {
+  // Clients that outlive the share handle keep it in use, in which case it is
+  // left to be released at exit
+  if (handle_)
+    curl_share_cleanup(handle_);
+}
+
+CURLSH* Share::handle() {
+  win::Lock lock(section_);
+
+  return Initialize() ? handle_ : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Share::Initialize() {
+  if (initialized_)
+    return handle_ != nullptr;
+
+  initialized_ = true;
+
+  handle_ = curl_share_init();
+  if (!handle_) {
+    LOG(LevelError, L"Could not create share handle");
+    return false;
+  }
+
+  curl_share_setopt(handle_, CURLSHOPT_LOCKFUNC, LockFunction);
+  curl_share_setopt(handle_, CURLSHOPT_UNLOCKFUNC, UnlockFunction);
+  curl_share_setopt(handle_, CURLSHOPT_USERDATA, this);
+
+  ShareData(CURL_LOCK_DATA_DNS);
+  ShareData(CURL_LOCK_DATA_SSL_SESSION);
+  // Not supported by older versions of libcurl, in which case connections are
+  // still shared by the transfers that are driven by the same multi handle
+  ShareData(CURL_LOCK_DATA_CONNECT);
+
+  return true;
+}
+
+bool Share::ShareData(curl_lock_data data) {
+  CURLSHcode code = curl_share_setopt(handle_, CURLSHOPT_SHARE, data);
+
+  if (code != CURLSHE_OK) {
+    LOG(LevelDebug, L"Could not share data (" +
+                    ToWstr(static_cast<int>(data)) + L"): " +
+                    StrToWstr(curl_share_strerror(code)));
+    return false;
+  }
+
+  return true;
+}
+
+void Share::LockFunction(CURL* handle, curl_lock_data data,
+                         curl_lock_access access, void* userptr) {
+  // Shared access is not told apart from exclusive access, as the data is
+  // hardly ever locked for long
+  auto share = reinterpret_cast<Share*>(userptr);
+  share->locks_[data].Enter();
+}
+
+void Share::UnlockFunction(CURL* handle, curl_lock_data data, void* userptr) {
+  auto share = reinterpret_cast<Share*>(userptr);
+  share->locks_[data].Leave();
+}
+
+}  // namespace http
+}  // namespace base
\ No newline at end of file
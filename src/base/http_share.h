@@ -0,0 +1,56 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_HTTP_SHARE_H
+#define TAIGA_BASE_HTTP_SHARE_H
+
+#include <curl/curl.h>
+
+#include "win/win_thread.h"
+
+namespace base {
+namespace http {
+
+// A share handle lets clients reuse each other's DNS lookups, TLS sessions and
+// connections, instead of each easy handle keeping a cache of its own. Clients
+// may run on different threads, so each kind of shared data has its own lock.
+
+class Share {
+public:
+  Share();
+  ~Share();
+
+  CURLSH* handle();
+
+private:
+  static void LockFunction(CURL*, curl_lock_data, curl_lock_access, void*);
+  static void UnlockFunction(CURL*, curl_lock_data, void*);
+
+  bool Initialize();
+  bool ShareData(curl_lock_data data);
+
+  CURLSH* handle_;
+  bool initialized_;
+  win::CriticalSection locks_[CURL_LOCK_DATA_LAST];
+  win::CriticalSection section_;
+};
+
+}  // namespace http
+}  // namespace base
+
+#endif  // TAIGA_BASE_HTTP_SHARE_H
\ No newline at end of file
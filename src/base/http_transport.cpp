@@ -0,0 +1,332 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "foreach.h"
+#include "http.h"
+#include "http_transport.h"
+#include "log.h"
+
+namespace base {
+namespace http {
+
+// While there are transfers in progress, the loop wakes up at least this often
+// to pick up new ones
+const int kTransportWaitTimeout = 50;  // milliseconds
+
+Transport::LoopThread::LoopThread()
+    : io(false), transport(nullptr) {
+}
+
+DWORD Transport::LoopThread::ThreadProc() {
+  return io ? transport->RunIoLoop() : transport->RunDispatchLoop();
+}
+
+Transport::Transport()
+    : completion_event_(nullptr),
+      initialized_(false),
+      multi_handle_(nullptr),
+      pending_event_(nullptr),
+      stopping_(false) {
+}
+
+Transport::~Transport() {
+  Shutdown();
+
+  if (multi_handle_)
+    curl_multi_cleanup(multi_handle_);
+  if (completion_event_)
+    ::CloseHandle(completion_event_);
+  if (pending_event_)
+    ::CloseHandle(pending_event_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Waits for the object while still handling messages that are sent to the
+// windows of the calling thread, as the transport threads may be blocked on
+// such a message
+static void WaitForObject(HANDLE handle) {
+  while (::MsgWaitForMultipleObjects(1, &handle, FALSE, INFINITE,
+                                     QS_SENDMESSAGE) != WAIT_OBJECT_0) {
+    MSG msg;
+    ::PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
+  }
+}
+
+bool Transport::Add(Client* client) {
+  win::Lock lock(pending_section_);
+
+  if (stopping_ || !Initialize())
+    return false;
+
+  pending_clients_.push_back(client);
+  attached_clients_.push_back(client);
+  ::SetEvent(pending_event_);
+
+  return true;
+}
+
+void Transport::Remove(Client* client) {
+  HANDLE removed_event = nullptr;
+
+  {
+    win::Lock lock(pending_section_);
+
+    pending_clients_.erase(
+        std::remove(pending_clients_.begin(), pending_clients_.end(), client),
+        pending_clients_.end());
+
+    auto it = std::find(attached_clients_.begin(), attached_clients_.end(),
+                        client);
+    if (it != attached_clients_.end()) {
+      attached_clients_.erase(it);
+      if (::GetCurrentThreadId() == io_thread_.GetThreadId()) {
+        RemoveHandle(client);
+      } else {
+        // The handle may be in use by curl, so only the I/O thread can remove
+        // it between two calls to curl_multi_perform
+        removed_event = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (removed_event) {
+          removals_.push_back(std::make_pair(client, removed_event));
+          ::SetEvent(pending_event_);
+        }
+      }
+    }
+  }
+
+  if (removed_event) {
+    WaitForObject(removed_event);
+    ::CloseHandle(removed_event);
+  }
+
+  {
+    win::Lock lock(completion_section_);
+    for (auto it = completions_.begin(); it != completions_.end(); ) {
+      if (it->first == client) {
+        it = completions_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void Transport::Shutdown() {
+  {
+    win::Lock lock(pending_section_);
+    {
+      win::Lock lock(completion_section_);
+      stopping_ = true;
+    }
+    if (!initialized_)
+      return;
+    initialized_ = false;
+  }
+
+  ::SetEvent(pending_event_);
+  ::SetEvent(completion_event_);
+
+  // A thread that could not be created has no handle to wait for
+  if (io_thread_.GetThreadHandle()) {
+    WaitForObject(io_thread_.GetThreadHandle());
+    io_thread_.CloseThreadHandle();
+  }
+  if (dispatch_thread_.GetThreadHandle()) {
+    WaitForObject(dispatch_thread_.GetThreadHandle());
+    dispatch_thread_.CloseThreadHandle();
+  }
+
+  {
+    win::Lock lock(pending_section_);
+
+    foreach_(it, active_clients_)
+      curl_multi_remove_handle(multi_handle_, (*it)->curl_handle_);
+    active_clients_.clear();
+    attached_clients_.clear();
+    pending_clients_.clear();
+
+    foreach_(it, removals_)
+      ::SetEvent(it->second);
+    removals_.clear();
+  }
+
+  {
+    win::Lock lock(completion_section_);
+    completions_.clear();
+  }
+
+  curl_multi_cleanup(multi_handle_);
+  multi_handle_ = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Transport::Initialize() {
+  if (initialized_)
+    return true;
+
+  if (!multi_handle_)
+    multi_handle_ = curl_multi_init();
+  if (!multi_handle_)
+    return false;
+
+  if (!completion_event_)
+    completion_event_ = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+  if (!pending_event_)
+    pending_event_ = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+  if (!completion_event_ || !pending_event_)
+    return false;
+
+  io_thread_.io = true;
+  io_thread_.transport = this;
+  dispatch_thread_.transport = this;
+
+  if (!io_thread_.CreateThread(nullptr, 0, 0) ||
+      !dispatch_thread_.CreateThread(nullptr, 0, 0)) {
+    LOG(LevelError, L"Could not create transport threads.");
+    // Shutdown() still joins the thread that could be created
+    stopping_ = true;
+    initialized_ = true;
+    return false;
+  }
+
+  initialized_ = true;
+  return true;
+}
+
+void Transport::Detach(Client* client) {
+  win::Lock lock(pending_section_);
+  attached_clients_.erase(
+      std::remove(attached_clients_.begin(), attached_clients_.end(), client),
+      attached_clients_.end());
+}
+
+void Transport::ReadCompletions() {
+  CURLMsg* message = nullptr;
+  int remaining = 0;
+
+  while ((message = curl_multi_info_read(multi_handle_, &remaining))) {
+    if (message->msg != CURLMSG_DONE)
+      continue;
+
+    CURL* curl_handle = message->easy_handle;
+    CURLcode code = message->data.result;
+
+    curl_multi_remove_handle(multi_handle_, curl_handle);
+
+    foreach_(it, active_clients_) {
+      if ((*it)->curl_handle_ == curl_handle) {
+        Client* client = *it;
+        active_clients_.erase(it);
+        Detach(client);
+        {
+          win::Lock lock(completion_section_);
+          completions_.push_back(std::make_pair(client, code));
+        }
+        ::SetEvent(completion_event_);
+        break;
+      }
+    }
+  }
+}
+
+void Transport::RemoveHandle(Client* client) {
+  auto it = std::find(active_clients_.begin(), active_clients_.end(), client);
+  if (it != active_clients_.end()) {
+    curl_multi_remove_handle(multi_handle_, client->curl_handle_);
+    active_clients_.erase(it);
+  }
+}
+
+DWORD Transport::RunDispatchLoop() {
+  while (true) {
+    ::WaitForSingleObject(completion_event_, INFINITE);
+
+    while (true) {
+      completion_t completion;
+      {
+        win::Lock lock(completion_section_);
+        if (stopping_)
+          return 0;
+        if (completions_.empty())
+          break;
+        completion = completions_.front();
+        completions_.pop_front();
+      }
+      completion.first->FinishTransfer(completion.second);
+    }
+  }
+
+  return 0;
+}
+
+DWORD Transport::RunIoLoop() {
+  while (true) {
+    std::vector<Client*> clients;
+    std::vector<removal_t> removals;
+    {
+      win::Lock lock(pending_section_);
+      if (stopping_)
+        break;
+      std::swap(clients, pending_clients_);
+      std::swap(removals, removals_);
+    }
+
+    foreach_(it, removals) {
+      RemoveHandle(it->first);
+      ::SetEvent(it->second);
+    }
+
+    foreach_(it, clients) {
+      if (curl_multi_add_handle(multi_handle_, (*it)->curl_handle_) ==
+          CURLM_OK) {
+        active_clients_.push_back(*it);
+      } else {
+        Detach(*it);
+        {
+          win::Lock lock(completion_section_);
+          completions_.push_back(std::make_pair(*it, CURLE_FAILED_INIT));
+        }
+        ::SetEvent(completion_event_);
+      }
+    }
+
+    if (!active_clients_.empty()) {
+      int running_handles = 0;
+      curl_multi_perform(multi_handle_, &running_handles);
+      ReadCompletions();
+
+      if (!active_clients_.empty()) {
+        int numfds = 0;
+        curl_multi_wait(multi_handle_, nullptr, 0, kTransportWaitTimeout,
+                        &numfds);
+        continue;
+      }
+    }
+
+    // Nothing to do until a new transfer is added, or a client is removed
+    ::WaitForSingleObject(pending_event_, INFINITE);
+  }
+
+  return 0;
+}
+
+}  // namespace http
+}  // namespace base
\ No newline at end of file
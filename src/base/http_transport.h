@@ -0,0 +1,92 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_HTTP_TRANSPORT_H
+#define TAIGA_BASE_HTTP_TRANSPORT_H
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "http.h"
+#include "win/win_thread.h"
+
+namespace base {
+namespace http {
+
+// The transport drives every transfer from a single thread through a curl
+// multi handle, instead of having each client block on a thread of its own.
+// Completed transfers are queued and handed back to their clients on another
+// thread, so that a slow response handler does not hold up other transfers.
+//
+// Only the I/O thread touches the multi handle. It is not locked while curl
+// runs, because client callbacks may wait on other threads; clients are
+// removed by asking the I/O thread instead.
+
+class Transport {
+public:
+  Transport();
+  ~Transport();
+
+  bool Add(Client* client);
+  void Remove(Client* client);
+  // Stops and joins both threads. Clients cannot be added afterwards; Add()
+  // returns false then, as it does when the threads cannot be started, and
+  // the request fails without its callbacks being called.
+  void Shutdown();
+
+private:
+  class LoopThread : public win::Thread {
+  public:
+    LoopThread();
+    DWORD ThreadProc();
+
+    bool io;
+    Transport* transport;
+  };
+
+  typedef std::pair<Client*, CURLcode> completion_t;
+  typedef std::pair<Client*, HANDLE> removal_t;
+
+  bool Initialize();
+  void Detach(Client* client);
+  void ReadCompletions();
+  void RemoveHandle(Client* client);
+  DWORD RunDispatchLoop();
+  DWORD RunIoLoop();
+
+  std::vector<Client*> active_clients_;
+  std::vector<Client*> attached_clients_;
+  std::deque<completion_t> completions_;
+  HANDLE completion_event_;
+  win::CriticalSection completion_section_;
+  LoopThread dispatch_thread_;
+  bool initialized_;
+  LoopThread io_thread_;
+  CURLM* multi_handle_;
+  std::vector<Client*> pending_clients_;
+  HANDLE pending_event_;
+  win::CriticalSection pending_section_;
+  std::vector<removal_t> removals_;
+  bool stopping_;
+};
+
+}  // namespace http
+}  // namespace base
+
+#endif  // TAIGA_BASE_HTTP_TRANSPORT_H
\ No newline at end of file
@@ -29,4 +29,120 @@ bool JsonReadArray(const Json::Value& root, const std::string& name,
     output.push_back(StrToWstr(value[i].asString()));
 
   return output.size() > previous_size;
+}
+
+bool JsonParse(const std::string& document, Json::Value& root) {
+  Json::Reader reader;
+
+  // Parsing from a pointer range saves the copy that Json::Reader makes of
+  // a std::string
+  const char* begin = document.data();
+  return reader.parse(begin, begin + document.size(), root, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+JsonArrayReader::JsonArrayReader(const std::string& document)
+    : current_(document.data()),
+      end_(document.data() + document.size()),
+      failed_(false),
+      finished_(false),
+      started_(false) {
+}
+
+bool JsonArrayReader::Read(Json::Value& value) {
+  if (failed_ || finished_)
+    return false;
+
+  SkipWhitespace();
+
+  if (!started_) {
+    if (current_ == end_ || *current_ != '[') {
+      failed_ = true;
+      return false;
+    }
+    ++current_;
+    started_ = true;
+    SkipWhitespace();
+    if (current_ < end_ && *current_ == ']') {
+      finished_ = true;
+      return false;
+    }
+  } else {
+    if (current_ < end_ && *current_ == ']') {
+      finished_ = true;
+      return false;
+    }
+    if (current_ == end_ || *current_ != ',') {
+      failed_ = true;
+      return false;
+    }
+    ++current_;
+    SkipWhitespace();
+  }
+
+  const char* element_end = FindElementEnd();
+  if (!element_end) {
+    failed_ = true;
+    return false;
+  }
+
+  Json::Reader reader;
+  if (!reader.parse(current_, element_end, value, false)) {
+    failed_ = true;
+    return false;
+  }
+
+  current_ = element_end;
+  return true;
+}
+
+bool JsonArrayReader::failed() const {
+  return failed_;
+}
+
+const char* JsonArrayReader::FindElementEnd() const {
+  int depth = 0;
+  bool in_string = false;
+
+  for (const char* p = current_; p < end_; ++p) {
+    if (in_string) {
+      if (*p == '\\') {
+        ++p;  // Skip the escaped character
+      } else if (*p == '"') {
+        in_string = false;
+      }
+      continue;
+    }
+
+    switch (*p) {
+      case '"':
+        in_string = true;
+        break;
+      case '{':
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        if (depth == 0)
+          return p > current_ ? p : nullptr;  // End of the enclosing array
+        if (--depth == 0)
+          return p + 1;
+        break;
+      case ',':
+        if (depth == 0)
+          return p > current_ ? p : nullptr;
+        break;
+    }
+  }
+
+  return nullptr;
+}
+
+void JsonArrayReader::SkipWhitespace() {
+  while (current_ < end_ &&
+         (*current_ == ' ' || *current_ == '\t' ||
+          *current_ == '\r' || *current_ == '\n'))
+    ++current_;
 }
\ No newline at end of file
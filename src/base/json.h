@@ -25,5 +25,31 @@
 #include <jsoncpp/json/json.h>
 
 bool JsonReadArray(const Json::Value& root, const std::string& name, std::vector<std::wstring>& output);
+bool JsonParse(const std::string& document, Json::Value& root);
+
+// Reads the elements of a top-level array one at a time, directly from a
+// UTF-8 buffer, so that a tree is never built for more than one element. The
+// buffer must outlive the reader.
+
+class JsonArrayReader {
+public:
+  JsonArrayReader(const std::string& document);
+  ~JsonArrayReader() {}
+
+  // Returns false at the end of the array, or on failure
+  bool Read(Json::Value& value);
+
+  bool failed() const;
+
+private:
+  const char* FindElementEnd() const;
+  void SkipWhitespace();
+
+  const char* current_;
+  const char* end_;
+  bool failed_;
+  bool finished_;
+  bool started_;
+};
 
 #endif  // TAIGA_BASE_JSON_H
\ No newline at end of file
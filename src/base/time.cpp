@@ -192,6 +192,45 @@ std::wstring ToTimeString(int seconds) {
   #undef TWO_DIGIT
 }
 
+time_t ToTimestamp(const std::wstring& datetime) {
+  if (datetime.length() < 10)
+    return 0;
+
+  tm t = {0};
+  t.tm_year = ToInt(datetime.substr(0, 4)) - 1900;
+  t.tm_mon = ToInt(datetime.substr(5, 2)) - 1;
+  t.tm_mday = ToInt(datetime.substr(8, 2));
+  if (datetime.length() >= 19) {
+    t.tm_hour = ToInt(datetime.substr(11, 2));
+    t.tm_min = ToInt(datetime.substr(14, 2));
+    t.tm_sec = ToInt(datetime.substr(17, 2));
+  }
+  t.tm_isdst = -1;
+
+  time_t timestamp = mktime(&t);
+  return timestamp != -1 ? timestamp : 0;
+}
+
+std::wstring ToDateTimeString(time_t timestamp) {
+  tm t;
+  if (localtime_s(&t, &timestamp) != 0)
+    return std::wstring();
+
+  WCHAR buff[32];
+  swprintf_s(buff, L"%04d-%02d-%02d %02d:%02d:%02d",
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+             t.tm_hour, t.tm_min, t.tm_sec);
+  return buff;
+}
+
+Date TimestampToDate(time_t timestamp) {
+  tm t;
+  if (localtime_s(&t, &timestamp) != 0)
+    return Date();
+
+  return Date(t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+}
+
 const Date& EmptyDate() {
   static const Date date;
   return date;
@@ -60,6 +60,11 @@ std::wstring ToDateString(time_t seconds);
 unsigned int ToDayCount(const Date& date);
 std::wstring ToTimeString(int seconds);
 
+// Conversions between "YYYY-MM-DD HH:MM:SS" (local time) and epoch seconds
+time_t ToTimestamp(const std::wstring& datetime);
+std::wstring ToDateTimeString(time_t timestamp);
+Date TimestampToDate(time_t timestamp);
+
 const Date& EmptyDate();
 
 #endif  // TAIGA_BASE_TIME_H
\ No newline at end of file
@@ -0,0 +1,383 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <cstring>
+
+#include "xml_reader.h"
+
+XmlReader::XmlReader(const char* data, size_t size)
+    : current_(data),
+      end_(data + size),
+      empty_element_(false),
+      type_(kNodeNone) {
+  // Skip the byte order mark
+  if (size >= 3 && !memcmp(data, "\xEF\xBB\xBF", 3))
+    current_ += 3;
+}
+
+XmlReader::XmlReader(const std::string& data)
+    : current_(data.data()),
+      end_(data.data() + data.size()),
+      empty_element_(false),
+      type_(kNodeNone) {
+  if (data.size() >= 3 && !data.compare(0, 3, "\xEF\xBB\xBF"))
+    current_ += 3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+XmlReader::NodeType XmlReader::Read() {
+  if (type_ == kNodeEnd || type_ == kNodeError)
+    return type_;
+
+  // An empty element (e.g. <tag/>) is reported as a start tag, followed by an
+  // end tag
+  if (empty_element_) {
+    empty_element_ = false;
+    elements_.pop_back();
+    type_ = kNodeElementEnd;
+    return type_;
+  }
+
+  while (current_ < end_) {
+    bool success = *current_ == '<' ? ReadMarkup() : ReadText();
+    if (!success) {
+      SetError();
+      return type_;
+    }
+    if (type_ != kNodeNone)
+      return type_;
+  }
+
+  if (elements_.empty()) {
+    type_ = kNodeEnd;
+  } else {
+    SetError();
+  }
+
+  return type_;
+}
+
+bool XmlReader::ReadToElement(const char* name) {
+  size_t depth = elements_.size();
+
+  while (true) {
+    switch (Read()) {
+      case kNodeElementStart:
+        if (name_ == name)
+          return true;
+        break;
+      case kNodeElementEnd:
+        if (elements_.size() < depth)
+          return false;
+        break;
+      case kNodeEnd:
+      case kNodeError:
+        return false;
+    }
+  }
+}
+
+bool XmlReader::ReadElementText(std::string& text) {
+  text.clear();
+
+  if (type_ != kNodeElementStart)
+    return false;
+
+  size_t depth = elements_.size() - 1;
+
+  while (true) {
+    switch (Read()) {
+      case kNodeElementStart:
+        // Like pugixml's child_value(), only direct text is returned
+        if (!SkipElement())
+          return false;
+        break;
+      case kNodeElementEnd:
+        if (elements_.size() == depth)
+          return true;
+        break;
+      case kNodeText:
+        text.append(value_);
+        break;
+      case kNodeEnd:
+      case kNodeError:
+        return false;
+    }
+  }
+}
+
+bool XmlReader::SkipElement() {
+  if (type_ != kNodeElementStart)
+    return false;
+
+  size_t depth = elements_.size() - 1;
+
+  while (true) {
+    switch (Read()) {
+      case kNodeElementEnd:
+        if (elements_.size() == depth)
+          return true;
+        break;
+      case kNodeEnd:
+      case kNodeError:
+        return false;
+    }
+  }
+}
+
+bool XmlReader::IsElement(const char* name) const {
+  return type_ == kNodeElementStart && name_ == name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t XmlReader::depth() const {
+  return elements_.size();
+}
+
+const std::string& XmlReader::name() const {
+  return name_;
+}
+
+XmlReader::NodeType XmlReader::type() const {
+  return type_;
+}
+
+const std::string& XmlReader::value() const {
+  return value_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool IsXmlWhitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static const char* FindString(const char* begin, const char* end,
+                              const char* str) {
+  size_t length = strlen(str);
+
+  for (const char* p = begin; p + length <= end; ++p)
+    if (*p == *str && !memcmp(p, str, length))
+      return p;
+
+  return nullptr;
+}
+
+static bool HasPrefix(const char* begin, const char* end, const char* str) {
+  size_t length = strlen(str);
+  return static_cast<size_t>(end - begin) >= length &&
+         !memcmp(begin, str, length);
+}
+
+bool XmlReader::ReadMarkup() {
+  type_ = kNodeNone;
+
+  // Processing instruction or XML declaration
+  if (HasPrefix(current_, end_, "<?")) {
+    const char* p = FindString(current_ + 2, end_, "?>");
+    if (!p)
+      return false;
+    current_ = p + 2;
+    return true;
+  }
+
+  // Comment
+  if (HasPrefix(current_, end_, "<!--")) {
+    const char* p = FindString(current_ + 4, end_, "-->");
+    if (!p)
+      return false;
+    current_ = p + 3;
+    return true;
+  }
+
+  // CDATA section
+  if (HasPrefix(current_, end_, "<![CDATA[")) {
+    const char* begin = current_ + 9;
+    const char* p = FindString(begin, end_, "]]>");
+    if (!p)
+      return false;
+    value_.assign(begin, p);
+    current_ = p + 3;
+    type_ = kNodeText;
+    return true;
+  }
+
+  // Document type declaration, possibly with an internal subset
+  if (HasPrefix(current_, end_, "<!")) {
+    int brackets = 0;
+    for (const char* p = current_ + 2; p < end_; ++p) {
+      if (*p == '[') {
+        brackets++;
+      } else if (*p == ']') {
+        brackets--;
+      } else if (*p == '>' && brackets <= 0) {
+        current_ = p + 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool end_tag = HasPrefix(current_, end_, "</");
+  const char* p = current_ + (end_tag ? 2 : 1);
+
+  const char* name_begin = p;
+  while (p < end_ && !IsXmlWhitespace(*p) && *p != '/' && *p != '>')
+    ++p;
+  if (p == name_begin || p == end_)
+    return false;
+  name_.assign(name_begin, p);
+
+  if (end_tag) {
+    while (p < end_ && IsXmlWhitespace(*p))
+      ++p;
+    if (p == end_ || *p != '>')
+      return false;
+    if (elements_.empty() || elements_.back() != name_)
+      return false;
+    elements_.pop_back();
+    current_ = p + 1;
+    type_ = kNodeElementEnd;
+    return true;
+  }
+
+  // Skip attributes, taking care of quoted values that may contain '>'
+  while (p < end_ && *p != '>') {
+    if (*p == '"' || *p == '\'') {
+      const char* quote = static_cast<const char*>(memchr(p + 1, *p, end_ - p - 1));
+      if (!quote)
+        return false;
+      p = quote + 1;
+    } else if (*p == '/' && p + 1 < end_ && *(p + 1) == '>') {
+      empty_element_ = true;
+      ++p;
+    } else {
+      ++p;
+    }
+  }
+  if (p == end_)
+    return false;
+
+  elements_.push_back(name_);
+  value_.clear();
+  current_ = p + 1;
+  type_ = kNodeElementStart;
+  return true;
+}
+
+bool XmlReader::ReadText() {
+  type_ = kNodeNone;
+  value_.clear();
+
+  bool whitespace_only = true;
+
+  while (current_ < end_ && *current_ != '<') {
+    if (*current_ == '&') {
+      if (!DecodeReference(value_))
+        return false;
+      whitespace_only = false;
+      continue;
+    }
+
+    const char* p = current_;
+    while (p < end_ && *p != '<' && *p != '&') {
+      if (whitespace_only && !IsXmlWhitespace(*p))
+        whitespace_only = false;
+      ++p;
+    }
+    value_.append(current_, p);
+    current_ = p;
+  }
+
+  // Whitespace between elements is ignored, as it is in pugixml by default
+  if (!whitespace_only) {
+    if (elements_.empty())
+      return false;
+    type_ = kNodeText;
+  }
+
+  return true;
+}
+
+bool XmlReader::DecodeReference(std::string& output) {
+  const char* begin = current_ + 1;
+  const char* end = static_cast<const char*>(memchr(begin, ';', end_ - begin));
+
+  // Unknown or malformed references are kept as they are, which is what
+  // pugixml does as well
+  if (!end || end - begin > 10) {
+    output.push_back(*current_++);
+    return true;
+  }
+
+  std::string name(begin, end);
+  unsigned long code_point = 0;
+
+  if (name == "amp") {
+    output.push_back('&');
+  } else if (name == "lt") {
+    output.push_back('<');
+  } else if (name == "gt") {
+    output.push_back('>');
+  } else if (name == "quot") {
+    output.push_back('"');
+  } else if (name == "apos") {
+    output.push_back('\'');
+  } else if (name.size() > 1 && name.at(0) == '#') {
+    char* parse_end = nullptr;
+    if (name.at(1) == 'x' || name.at(1) == 'X') {
+      code_point = strtoul(name.c_str() + 2, &parse_end, 16);
+    } else {
+      code_point = strtoul(name.c_str() + 1, &parse_end, 10);
+    }
+    if (!parse_end || *parse_end || !code_point || code_point > 0x10FFFF) {
+      output.push_back(*current_++);
+      return true;
+    }
+    // Encode as UTF-8
+    if (code_point < 0x80) {
+      output.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      output.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+      output.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      output.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  } else {
+    output.push_back(*current_++);
+    return true;
+  }
+
+  current_ = end + 1;
+  return true;
+}
+
+void XmlReader::SetError() {
+  type_ = kNodeError;
+  empty_element_ = false;
+}
\ No newline at end of file
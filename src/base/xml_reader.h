@@ -0,0 +1,80 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_XML_READER_H
+#define TAIGA_BASE_XML_READER_H
+
+#include <string>
+#include <vector>
+
+// A forward-only, pull-based reader that works directly on a UTF-8 buffer,
+// without building a document tree. Only the subset of XML that web APIs
+// actually send is supported: elements, text, CDATA sections and the
+// predefined and numeric character references. Attributes, comments,
+// processing instructions and DTDs are skipped. The buffer must outlive the
+// reader.
+
+class XmlReader {
+public:
+  enum NodeType {
+    kNodeNone,
+    kNodeElementStart,
+    kNodeElementEnd,
+    kNodeText,
+    kNodeEnd,
+    kNodeError
+  };
+
+  XmlReader(const char* data, size_t size);
+  XmlReader(const std::string& data);
+  ~XmlReader() {}
+
+  // Advances to the next node and returns its type
+  NodeType Read();
+  // Moves to the next start tag with the given name, at any depth below the
+  // current element
+  bool ReadToElement(const char* name);
+  // Reads the text of the current element and moves past its end tag
+  bool ReadElementText(std::string& text);
+  // Moves past the end tag of the current element
+  bool SkipElement();
+
+  bool IsElement(const char* name) const;
+
+  size_t depth() const;
+  const std::string& name() const;
+  NodeType type() const;
+  const std::string& value() const;
+
+private:
+  bool ReadMarkup();
+  bool ReadText();
+  bool DecodeReference(std::string& output);
+  void SetError();
+
+  const char* current_;
+  const char* end_;
+
+  std::vector<std::string> elements_;
+  bool empty_element_;
+  std::string name_;
+  NodeType type_;
+  std::string value_;
+};
+
+#endif  // TAIGA_BASE_XML_READER_H
\ No newline at end of file
@@ -41,7 +41,13 @@ anime::Database AnimeDatabase;
 
 namespace anime {
 
+Database::Database()
+    : last_reconciled(0), last_updated(0) {
+}
+
 bool Database::LoadDatabase() {
+  LoadIdMap();
+
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
   unsigned int options = pugi::parse_default & ~pugi::parse_eol;
@@ -96,6 +102,7 @@ void Database::ReadDatabaseNode(xml_node& database_node) {
 
     foreach_(it, id_map)
       item.SetId(it->second, it->first);
+    MapItemIds(item);
 
     std::vector<std::wstring> synonyms;
     XmlReadChildNodes(node, synonyms, L"synonym");
@@ -135,6 +142,8 @@ bool Database::SaveDatabase() {
   xml_node database_node = document.append_child(L"database");
   WriteDatabaseNode(database_node);
 
+  SaveIdMap();
+
   std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
   return XmlWriteDocumentToFile(document, path);
 }
@@ -203,10 +212,28 @@ Item* Database::FindItem(int id) {
 }
 
 Item* Database::FindItem(const std::wstring& id, enum_t service) {
-  if (!id.empty())
-    foreach_(it, items)
-      if (id == it->second.GetId(service))
-        return &it->second;
+  if (id.empty())
+    return nullptr;
+
+  // The table is only trusted if the item it points to has the same ID, as
+  // the table outlives the items and may be out of date
+  auto service_it = anime_ids_.find(service);
+  if (service_it != anime_ids_.end()) {
+    auto id_it = service_it->second.find(id);
+    if (id_it != service_it->second.end()) {
+      auto item = FindItem(id_it->second);
+      if (item && item->GetId(service) == id)
+        return item;
+    }
+  }
+
+  // Otherwise we look through the items, and fix the table if we find one
+  foreach_(it, items) {
+    if (id == it->second.GetId(service)) {
+      MapId(it->first, id, service);
+      return &it->second;
+    }
+  }
 
   return nullptr;
 }
@@ -239,6 +266,117 @@ Item* Database::FindSequel(int anime_id) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+std::wstring Database::GetMappedId(int anime_id, enum_t service) {
+  auto item = FindItem(anime_id);
+  if (item && !item->GetId(service).empty())
+    return item->GetId(service);
+
+  auto it = service_ids_.find(anime_id);
+  if (it == service_ids_.end())
+    return std::wstring();
+  auto id_it = it->second.find(service);
+  if (id_it == it->second.end())
+    return std::wstring();
+
+  // The mapping must go both ways, or the ID has since been given to another
+  // item
+  auto service_it = anime_ids_.find(service);
+  if (service_it != anime_ids_.end()) {
+    auto anime_id_it = service_it->second.find(id_it->second);
+    if (anime_id_it != service_it->second.end() &&
+        anime_id_it->second == anime_id)
+      return id_it->second;
+  }
+
+  return std::wstring();
+}
+
+void Database::MapId(int anime_id, const std::wstring& id, enum_t service) {
+  if (anime_id <= ID_UNKNOWN || id.empty())
+    return;
+
+  std::map<std::wstring, int>& ids = anime_ids_[service];
+
+  // The item's previous ID no longer refers to it...
+  std::wstring& previous_id = service_ids_[anime_id][service];
+  if (!previous_id.empty() && previous_id != id) {
+    auto it = ids.find(previous_id);
+    if (it != ids.end() && it->second == anime_id)
+      ids.erase(it);
+  }
+  previous_id = id;
+
+  // ...and an item that previously had this ID no longer refers to it
+  auto it = ids.find(id);
+  if (it != ids.end() && it->second != anime_id) {
+    auto other = service_ids_.find(it->second);
+    if (other != service_ids_.end()) {
+      auto other_id = other->second.find(service);
+      if (other_id != other->second.end() && other_id->second == id)
+        other->second.erase(other_id);
+    }
+  }
+
+  ids[id] = anime_id;
+}
+
+void Database::MapItemIds(const Item& item) {
+  for (enum_t i = sync::kTaiga; i <= sync::kLastService; i++)
+    MapId(item.GetId(), item.GetId(i), i);
+}
+
+bool Database::LoadIdMap() {
+  xml_document document;
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeIds);
+  xml_parse_result parse_result = document.load_file(path.c_str());
+
+  if (parse_result.status != pugi::status_ok)
+    return false;
+
+  xml_node ids_node = document.child(L"ids");
+  foreach_xmlnode_(node, ids_node, L"anime") {
+    int anime_id = node.attribute(L"id").as_int();
+    foreach_xmlnode_(id_node, node, L"id") {
+      std::wstring name = id_node.attribute(L"name").as_string();
+      enum_t service_id = ServiceManager.GetServiceIdByName(name);
+      MapId(anime_id, id_node.child_value(), service_id);
+    }
+  }
+
+  return true;
+}
+
+bool Database::SaveIdMap() {
+  if (service_ids_.empty())
+    return false;
+
+  xml_document document;
+
+  xml_node meta_node = document.append_child(L"meta");
+  XmlWriteStrValue(meta_node, L"version", std::wstring(Taiga.version).c_str());
+
+  xml_node ids_node = document.append_child(L"ids");
+
+  foreach_(it, service_ids_) {
+    xml_node anime_node = ids_node.append_child(L"anime");
+    anime_node.append_attribute(L"id") = it->first;
+    foreach_(id, it->second) {
+      if (id->first == sync::kTaiga || id->second.empty())
+        continue;
+      xml_node child = anime_node.append_child(L"id");
+      std::wstring name = ServiceManager.GetServiceNameById(
+          static_cast<sync::ServiceId>(id->first));
+      child.append_attribute(L"name") = name.c_str();
+      child.append_child(pugi::node_pcdata).set_value(id->second.c_str());
+    }
+  }
+
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeIds);
+  return XmlWriteDocumentToFile(document, path);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void Database::ClearInvalidItems() {
   for (auto it = items.begin(); it != items.end(); ) {
     if (!it->second.GetId() || it->first != it->second.GetId()) {
@@ -328,6 +466,18 @@ int Database::UpdateItem(const Item& new_item) {
       Meow.UpdateCleanTitles(item->GetId());
   }
 
+  // IDs are kept in the table even if the rest of the information is not new,
+  // and the table fills in the ones that the item is missing
+  for (enum_t i = sync::kFirstService; i <= sync::kLastService; i++) {
+    MapId(item->GetId(), new_item.GetId(i), i);
+    if (item->GetId(i).empty()) {
+      std::wstring id = GetMappedId(item->GetId(), i);
+      if (!id.empty())
+        item->SetId(id, i);
+    }
+  }
+  MapItemIds(*item);
+
   // Update user information
   if (new_item.IsInList()) {
     // Make sure our pointer to MyInformation class is valid
@@ -379,6 +529,9 @@ bool Database::LoadList() {
   std::wstring meta_version = XmlReadStrValue(meta_node, L"version");
 
   if (!meta_version.empty()) {
+    last_updated = _wtoi64(XmlReadStrValue(meta_node, L"last_updated").c_str());
+    last_reconciled = _wtoi64(XmlReadStrValue(meta_node, L"last_reconciled").c_str());
+
     xml_node node_database = document.child(L"database");
     ReadDatabaseNode(node_database);
 
@@ -418,6 +571,8 @@ bool Database::SaveList(bool include_database) {
 
   xml_node meta_node = document.append_child(L"meta");
   XmlWriteStrValue(meta_node, L"version", L"1.1");
+  XmlWriteStrValue(meta_node, L"last_updated", ToWstr(static_cast<INT64>(last_updated)).c_str());
+  XmlWriteStrValue(meta_node, L"last_reconciled", ToWstr(static_cast<INT64>(last_reconciled)).c_str());
 
   if (include_database) {
     xml_node node_database = document.append_child(L"database");
@@ -504,6 +659,9 @@ void Database::AddToList(int anime_id, int status) {
 void Database::ClearUserData() {
   ui::DlgAnimeList.SetCurrentId(ID_UNKNOWN);
 
+  last_updated = 0;
+  last_reconciled = 0;
+
   foreach_(it, items)
     it->second.RemoveFromUserList();
 }
@@ -524,7 +682,8 @@ bool Database::DeleteListItem(int anime_id) {
   return true;
 }
 
-void Database::UpdateItem(const HistoryItem& history_item) {
+void Database::UpdateItem(const HistoryItem& history_item, bool save,
+                          bool refresh) {
   auto anime_item = FindItem(history_item.anime_id);
 
   if (!anime_item)
@@ -562,12 +721,11 @@ void Database::UpdateItem(const HistoryItem& history_item) {
     DeleteListItem(anime_item->GetId());
   }
 
-  SaveList();
-
-  History.queue.Remove();
-  History.queue.Check(false);
+  if (save)
+    SaveList();
 
-  ui::OnLibraryEntryChange(history_item.anime_id);
+  if (refresh)
+    ui::OnLibraryEntryChange(history_item.anime_id);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -630,6 +788,7 @@ void Database::ReadDatabaseInCompatibilityMode(xml_document& document) {
     Item& item = items[ToInt(id)];  // Creates the item if it doesn't exist
     item.SetId(id, sync::kTaiga);
     item.SetId(id, sync::kMyAnimeList);
+    MapItemIds(item);
     item.SetTitle(XmlReadStrValue(node, L"series_title"));
     item.SetEnglishTitle(XmlReadStrValue(node, L"series_english"));
     item.SetSynonyms(XmlReadStrValue(node, L"series_synonyms"));
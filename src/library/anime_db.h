@@ -19,7 +19,9 @@
 #ifndef TAIGA_LIBRARY_ANIME_DB_H
 #define TAIGA_LIBRARY_ANIME_DB_H
 
+#include <ctime>
 #include <map>
+#include <string>
 
 #include "library/anime_item.h"
 
@@ -33,6 +35,9 @@ namespace anime {
 
 class Database {
 public:
+  Database();
+  ~Database() {}
+
   bool LoadDatabase();
   bool SaveDatabase();
 
@@ -40,6 +45,9 @@ public:
   Item* FindItem(const std::wstring& id, enum_t service);
   Item* FindSequel(int anime_id);
 
+  std::wstring GetMappedId(int anime_id, enum_t service);
+  void MapId(int anime_id, const std::wstring& id, enum_t service);
+
   void ClearInvalidItems();
   int UpdateItem(const Item& item);
 
@@ -52,12 +60,23 @@ public:
   void AddToList(int anime_id, int status);
   void ClearUserData();
   bool DeleteListItem(int anime_id);
-  void UpdateItem(const HistoryItem& history_item);
+  void UpdateItem(const HistoryItem& history_item, bool save = true,
+                  bool refresh = true);
 
 public:
   std::map<int, Item> items;
 
+  // The most recent update time of list entries, as reported by the service,
+  // and the last time the whole list was downloaded. These are stored with the
+  // list, which is specific to a user and a service.
+  time_t last_updated;
+  time_t last_reconciled;
+
 private:
+  bool LoadIdMap();
+  bool SaveIdMap();
+  void MapItemIds(const Item& item);
+
   void ReadDatabaseNode(pugi::xml_node& database_node);
   void WriteDatabaseNode(pugi::xml_node& database_node);
 
@@ -66,6 +85,11 @@ private:
   void HandleCompatibility(const std::wstring& meta_version);
   void ReadDatabaseInCompatibilityMode(pugi::xml_document& document);
   void ReadListInCompatibilityMode(pugi::xml_document& document);
+
+  // IDs of each service, mapped to our own IDs and back. The table is stored
+  // in its own file, and outlives the items themselves.
+  std::map<enum_t, std::map<std::wstring, int>> anime_ids_;
+  std::map<int, std::map<enum_t, std::wstring>> service_ids_;
 };
 
 }  // namespace anime
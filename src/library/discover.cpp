@@ -76,6 +76,9 @@ bool SeasonDatabase::Load(std::wstring file) {
 
     if (anime_item && anime_item->GetLastModified() >= modified) {
       anime_id = anime_item->GetId();
+      foreach_(it, id_map)
+        if (it->first != sync::kTaiga)
+          AnimeDatabase.MapId(anime_id, it->second, it->first);
     } else {
       auto current_service_id = taiga::GetCurrentServiceId();
       if (id_map[current_service_id].empty()) {
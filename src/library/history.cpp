@@ -16,6 +16,8 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
@@ -35,15 +37,213 @@ class ConfirmationQueue ConfirmationQueue;
 class History History;
 
 HistoryItem::HistoryItem()
-    : anime_id(anime::ID_UNKNOWN),
-      enabled(true),
-      mode(0) {
+    : enabled(true),
+      anime_id(anime::ID_UNKNOWN),
+      mode(0),
+      time(0),
+      sequence(0) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Initial number of slots, doubled whenever the buffer is full until it
+// reaches its limit
+const size_t kHistoryBufferMinCapacity = 64;
+// Older items are still kept in the history log, they are only left out of
+// the buffer
+const size_t kHistoryBufferDefaultLimit = 10000;
+// Number of items that are written to the history file for previous versions
+const size_t kHistoryCompatibilityItemLimit = 100;
+
+HistoryBuffer::HistoryBuffer()
+    : count_(0),
+      head_(0),
+      limit_(kHistoryBufferDefaultLimit) {  // 0 for unlimited
+}
+
+void HistoryBuffer::Append(const HistoryItem& item) {
+  if (limit_ > 0 && count_ >= limit_)
+    RemoveOldest();
+  if (count_ == slots_.size())
+    Grow();
+
+  slots_.at((head_ + count_) % slots_.size()) = item;
+  count_++;
+}
+
+void HistoryBuffer::Clear() {
+  count_ = 0;
+  head_ = 0;
+  slots_.clear();
+}
+
+void HistoryBuffer::Erase(size_t index) {
+  if (index >= count_)
+    return;
+
+  // Removing an item from the middle is only done on user request, so we can
+  // afford to rebuild the buffer.
+  std::vector<HistoryItem> items;
+  items.reserve(count_ - 1);
+  for (size_t i = 0; i < count_; i++)
+    if (i != index)
+      items.push_back(at(i));
+
+  Clear();
+  foreach_(it, items)
+    Append(*it);
+}
+
+const HistoryItem& HistoryBuffer::at(size_t index) const {
+  return slots_.at((head_ + index) % slots_.size());
+}
+
+bool HistoryBuffer::empty() const {
+  return count_ == 0;
+}
+
+size_t HistoryBuffer::size() const {
+  return count_;
+}
+
+void HistoryBuffer::GetRecentItems(
+    size_t count, std::vector<const HistoryItem*>& items) const {
+  count = min(count, count_);
+
+  for (size_t i = 0; i < count; i++)
+    items.push_back(&at(count_ - 1 - i));
+}
+
+void HistoryBuffer::Grow() {
+  size_t capacity = max(slots_.size() * 2, kHistoryBufferMinCapacity);
+  if (limit_ > 0)
+    capacity = min(capacity, limit_);
+
+  std::vector<HistoryItem> slots;
+  slots.reserve(capacity);
+  for (size_t i = 0; i < count_; i++)
+    slots.push_back(at(i));
+  slots.resize(capacity);
+
+  std::swap(slots_, slots);
+  head_ = 0;
+}
+
+void HistoryBuffer::RemoveOldest() {
+  if (count_ == 0)
+    return;
+
+  head_ = (head_ + 1) % slots_.size();
+  count_--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+HistoryTransaction::HistoryTransaction(HistoryQueue& queue)
+    : queue_(queue) {
+}
+
+void HistoryTransaction::Add(const HistoryItem& item) {
+  items_.push_back(item);
+}
+
+bool HistoryTransaction::Commit() {
+  if (items_.empty())
+    return true;
+
+  // Validate everything before touching the queue
+  foreach_c_(it, items_) {
+    if (!Validate(*it)) {
+      LOG(LevelWarning, L"Transaction cancelled: " + error_);
+      Discard();
+      return false;
+    }
+  }
+
+  // Items are added without saving or refreshing, as we do that only once for
+  // the whole transaction
+  foreach_(it, items_)
+    queue_.Add(*it, false);
+  items_.clear();
+
+  if (queue_.history)
+    queue_.history->Save();
+
+  ui::OnHistoryChange();
+
+  queue_.Check(true);
+
+  return true;
+}
+
+void HistoryTransaction::Discard() {
+  items_.clear();
+}
+
+const std::wstring& HistoryTransaction::error() const {
+  return error_;
+}
+
+size_t HistoryTransaction::size() const {
+  return items_.size();
+}
+
+bool HistoryTransaction::Validate(const HistoryItem& item) {
+  auto anime_item = AnimeDatabase.FindItem(item.anime_id);
+
+  if (!anime_item) {
+    error_ = L"Item does not exist in the database. ID: " +
+             ToWstr(item.anime_id);
+    return false;
+  }
+
+  if (item.mode != taiga::kHttpServiceAddLibraryEntry &&
+      !anime_item->IsInList()) {
+    error_ = L"Item is not in the list. ID: " + ToWstr(item.anime_id);
+    return false;
+  }
+
+  if (item.episode && (*item.episode < 0 ||
+      (anime_item->GetEpisodeCount() > 0 &&
+       *item.episode > anime_item->GetEpisodeCount()))) {
+    error_ = L"Invalid episode number: " + ToWstr(*item.episode) +
+             L" (ID: " + ToWstr(item.anime_id) + L")";
+    return false;
+  }
+
+  if (item.score && (*item.score < 0 || *item.score > 10)) {
+    error_ = L"Invalid score: " + ToWstr(*item.score) +
+             L" (ID: " + ToWstr(item.anime_id) + L")";
+    return false;
+  }
+
+  if (item.status && (*item.status < anime::kMyStatusFirst ||
+                      *item.status >= anime::kMyStatusLast)) {
+    error_ = L"Invalid status: " + ToWstr(*item.status) +
+             L" (ID: " + ToWstr(item.anime_id) + L")";
+    return false;
+  }
+
+  return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Number of updates that can be sent at the same time, each for a different
+// anime
+const size_t kMaxSimultaneousUpdates = 4;
+// Failed updates are retried with an exponential backoff, starting at 5 seconds
+// and capped at 5 minutes, until the user triggers another synchronization
+const int kMaxUpdateAttempts = 5;
+const time_t kUpdateRetryDelayMin = 5;
+const time_t kUpdateRetryDelayMax = 5 * 60;
+
 HistoryQueue::HistoryQueue()
     : index(0),
       history(nullptr),
-      updating(false) {
+      max_simultaneous_updates(kMaxSimultaneousUpdates),
+      updating(false),
+      next_sequence_(0) {
 }
 
 void HistoryQueue::Add(HistoryItem& item, bool save) {
@@ -93,41 +293,42 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
 
   // Edit previous item with the same ID...
   bool add_new_item = true;
-  if (!History.queue.updating) {
-    foreach_r_(it, items) {
-      if (it->anime_id == item.anime_id && it->enabled) {
-        if (it->mode != taiga::kHttpServiceAddLibraryEntry &&
-            it->mode != taiga::kHttpServiceDeleteLibraryEntry) {
-          if (!item.episode || (!it->episode && it == items.rbegin())) {
-            if (item.episode)
-              it->episode = *item.episode;
-            if (item.score)
-              it->score = *item.score;
-            if (item.status)
-              it->status = *item.status;
-            if (item.enable_rewatching)
-              it->enable_rewatching = *item.enable_rewatching;
-            if (item.tags)
-              it->tags = *item.tags;
-            if (item.date_start)
-              it->date_start = *item.date_start;
-            if (item.date_finish)
-              it->date_finish = *item.date_finish;
-            add_new_item = false;
-          }
-          if (!add_new_item) {
-            it->mode = taiga::kHttpServiceUpdateLibraryEntry;
-            it->time = (std::wstring)GetDate() + L" " + GetTime();
-          }
-          break;
-        }
-      }
+  auto it = FindPendingUpdate(item.anime_id);
+  // An update that is being sent cannot be modified anymore
+  if (it && IsInProgress(item.anime_id) &&
+      it == FindItemInProgress(item.anime_id))
+    it = nullptr;
+  if (it) {
+    if (!item.episode || (!it->episode && it == &items.back())) {
+      if (item.episode)
+        it->episode = *item.episode;
+      if (item.score)
+        it->score = *item.score;
+      if (item.status)
+        it->status = *item.status;
+      if (item.enable_rewatching)
+        it->enable_rewatching = *item.enable_rewatching;
+      if (item.tags)
+        it->tags = *item.tags;
+      if (item.date_start)
+        it->date_start = *item.date_start;
+      if (item.date_finish)
+        it->date_finish = *item.date_finish;
+      add_new_item = false;
+    }
+    if (!add_new_item) {
+      it->mode = taiga::kHttpServiceUpdateLibraryEntry;
+      it->time = time(nullptr);
     }
   }
   // ...or add a new one
   if (add_new_item) {
-    if (item.time.empty())
-      item.time = (std::wstring)GetDate() + L" " + GetTime();
+    if (!item.time)
+      item.time = time(nullptr);
+    item.sequence = next_sequence_++;
+    if (item.mode != taiga::kHttpServiceAddLibraryEntry &&
+        item.mode != taiga::kHttpServiceDeleteLibraryEntry)
+      pending_updates_[item.anime_id] = item.sequence;
     items.push_back(item);
   }
 
@@ -161,25 +362,28 @@ void HistoryQueue::Check(bool automatic) {
   if (items.empty())
     return;
 
-  if (!items[index].enabled) {
-    LOG(LevelDebug, L"Item is disabled, removing...");
-    Remove(index, true, true, false);
-    Check(automatic);
-    return;
+  // Remove items that are disabled or no longer in the database
+  bool needs_cleanup = false;
+  foreach_(it, items) {
+    if (!it->enabled) {
+      LOG(LevelDebug, L"Item is disabled, removing...");
+      needs_cleanup = true;
+    } else if (!AnimeDatabase.FindItem(it->anime_id)) {
+      LOG(LevelWarning, L"Item not found in list, removing... ID: " +
+                        ToWstr(it->anime_id));
+      it->enabled = false;
+      needs_cleanup = true;
+    }
   }
-
-  auto anime_item = AnimeDatabase.FindItem(items[index].anime_id);
-  if (!anime_item) {
-    LOG(LevelWarning, L"Item not found in list, removing... ID: " +
-                      ToWstr(items[index].anime_id));
-    Remove(index, true, true, false);
-    Check(automatic);
-    return;
+  if (needs_cleanup) {
+    RemoveDisabled(true, true);
+    if (items.empty())
+      return;
   }
 
   if (automatic && !Settings.GetBool(taiga::kApp_Option_EnableSync)) {
-    items[index].reason = L"Automatic synchronization is disabled";
-    LOG(LevelDebug, items[index].reason);
+    items.front().reason = L"Automatic synchronization is disabled";
+    LOG(LevelDebug, items.front().reason);
     return;
   }
 
@@ -188,17 +392,87 @@ void HistoryQueue::Check(bool automatic) {
     return;
   }
 
-  History.queue.updating = true;
-  ui::ChangeStatusText(L"Updating list... (" + anime_item->GetTitle() + L")");
+  // The user wants to synchronize right now, so there's no point in waiting
+  // for the failed updates to be retried
+  if (!automatic) {
+    for (auto it = retries_.begin(); it != retries_.end(); ) {
+      if (!IsInProgress(it->first)) {
+        retries_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  Dispatch();
+}
+
+void HistoryQueue::CheckRetries() {
+  if (retries_.empty() || !Taiga.logged_in)
+    return;
+
+  time_t now = time(nullptr);
+
+  foreach_(it, retries_) {
+    if (it->second.attempts < kMaxUpdateAttempts &&
+        it->second.next_attempt <= now &&
+        !IsInProgress(it->first)) {
+      Dispatch();
+      return;
+    }
+  }
+}
+
+void HistoryQueue::Dispatch() {
+  time_t now = time(nullptr);
+
+  // Select the first enabled item of each anime that has no update in progress
+  std::set<int> anime_ids;
+  foreach_(it, in_progress_)
+    anime_ids.insert(it->first);
+  std::vector<HistoryItem> pending_items;
+  foreach_(it, items) {
+    if (in_progress_.size() + pending_items.size() >= max_simultaneous_updates)
+      break;
+    if (!it->enabled)
+      continue;
+    if (!anime_ids.insert(it->anime_id).second)
+      continue;
+    auto retry = retries_.find(it->anime_id);
+    if (retry != retries_.end())
+      if (retry->second.attempts >= kMaxUpdateAttempts ||
+          retry->second.next_attempt > now)
+        continue;
+    pending_items.push_back(*it);
+  }
+
+  if (pending_items.empty())
+    return;
 
-  AnimeValues* anime_values = static_cast<AnimeValues*>(&items[index]);
-  sync::UpdateLibraryEntry(*anime_values, items[index].anime_id,
-      static_cast<taiga::HttpClientMode>(items[index].mode));
+  // Mark everything first, as responses may arrive before we're done here
+  foreach_(it, pending_items)
+    in_progress_[it->anime_id] = it->sequence;
+  updating = true;
+
+  foreach_(it, pending_items) {
+    auto anime_item = AnimeDatabase.FindItem(it->anime_id);
+    if (anime_item)
+      ui::ChangeStatusText(L"Updating list... (" + anime_item->GetTitle() + L")");
+
+    AnimeValues* anime_values = static_cast<AnimeValues*>(&(*it));
+    if (!sync::UpdateLibraryEntry(*anime_values, it->anime_id,
+            static_cast<taiga::HttpClientMode>(it->mode))) {
+      in_progress_.erase(it->anime_id);
+      updating = !in_progress_.empty();
+    }
+  }
 }
 
 void HistoryQueue::Clear(bool save) {
   items.clear();
   index = 0;
+  retries_.clear();
+  RebuildIndex();
 
   ui::OnHistoryChange();
 
@@ -253,6 +527,14 @@ HistoryItem* HistoryQueue::FindItem(int anime_id, int search_mode) {
   return nullptr;
 }
 
+HistoryItem* HistoryQueue::FindItemInProgress(int anime_id) {
+  auto it = in_progress_.find(anime_id);
+  if (it == in_progress_.end())
+    return nullptr;
+
+  return FindItemBySequence(it->second);
+}
+
 HistoryItem* HistoryQueue::GetCurrentItem() {
   if (!items.empty())
     return &items.at(index);
@@ -270,6 +552,92 @@ int HistoryQueue::GetItemCount() {
   return count;
 }
 
+void HistoryQueue::HandleUpdateCancel(int anime_id) {
+  // The item is kept to be sent again with the next check. It is not counted
+  // as a failed attempt, nor dispatched right away, as the request may have
+  // been cancelled because we are shutting down.
+  in_progress_.erase(anime_id);
+  updating = !in_progress_.empty();
+
+  if (!updating) {
+    ui::ClearStatusText();
+    FlushCompleted();
+  }
+}
+
+void HistoryQueue::HandleUpdateError(int anime_id) {
+  in_progress_.erase(anime_id);
+  updating = !in_progress_.empty();
+
+  RetryState& retry = retries_[anime_id];
+  retry.attempts++;
+  if (retry.attempts < kMaxUpdateAttempts) {
+    time_t delay = min(kUpdateRetryDelayMin << (retry.attempts - 1),
+                       kUpdateRetryDelayMax);
+    retry.next_attempt = time(nullptr) + delay;
+    LOG(LevelDebug, L"Retrying in " + ToWstr(static_cast<int>(delay)) +
+                    L" seconds. ID: " + ToWstr(anime_id));
+  } else {
+    retry.next_attempt = 0;
+    LOG(LevelWarning, L"Giving up after " + ToWstr(retry.attempts) +
+                      L" attempts. ID: " + ToWstr(anime_id));
+  }
+
+  // Updates for other anime can go on
+  Dispatch();
+
+  if (!updating)
+    FlushCompleted();
+}
+
+void HistoryQueue::HandleUpdateSuccess(int anime_id) {
+  auto history_item = FindItemInProgress(anime_id);
+
+  in_progress_.erase(anime_id);
+  retries_.erase(anime_id);
+  updating = !in_progress_.empty();
+
+  if (history_item) {
+    HistoryItem item = *history_item;
+    int position = static_cast<int>(history_item - &items.front());
+    AnimeDatabase.UpdateItem(item, false, false);
+    Remove(position, false, false);
+    completed_.push_back(anime_id);
+  }
+
+  Dispatch();
+
+  if (!updating)
+    FlushCompleted();
+}
+
+void HistoryQueue::FlushCompleted() {
+  if (completed_.empty())
+    return;
+
+  AnimeDatabase.SaveList();
+  history->Save();
+
+  ui::OnLibraryEntriesChange(completed_);
+  ui::OnHistoryChange();
+
+  completed_.clear();
+}
+
+void HistoryQueue::Reset() {
+  items.clear();
+  index = 0;
+  updating = false;
+  completed_.clear();
+  in_progress_.clear();
+  retries_.clear();
+  RebuildIndex();
+}
+
+bool HistoryQueue::IsInProgress(int anime_id) const {
+  return in_progress_.count(anime_id) > 0;
+}
+
 void HistoryQueue::Remove(int index, bool save, bool refresh, bool to_history) {
   if (index == -1)
     index = this->index;
@@ -277,16 +645,25 @@ void HistoryQueue::Remove(int index, bool save, bool refresh, bool to_history) {
   if (index < static_cast<int>(items.size())) {
     auto history_item = items.begin() + index;
 
-    if (to_history && history_item->episode && *history_item->episode > 0) {
-      history->items.push_back(*history_item);
-      if (history->limit > 0 &&
-          static_cast<int>(history->items.size()) > history->limit) {
-        history->items.erase(history->items.begin());
-      }
-    }
+    if (to_history && history_item->episode && *history_item->episode > 0)
+      history->AddItem(*history_item);
+
+    int anime_id = history_item->anime_id;
+    auto pending_update = pending_updates_.find(anime_id);
+    bool indexed = pending_update != pending_updates_.end() &&
+                   pending_update->second == history_item->sequence;
 
     items.erase(history_item);
 
+    // The remaining items keep their sequence numbers, but if this was where
+    // new values were merged into, an earlier update of the same anime takes
+    // its place. Updates are removed once they are sent, which is near the
+    // front of the queue, so the search is short.
+    if (indexed) {
+      pending_updates_.erase(pending_update);
+      IndexPendingUpdate(anime_id, static_cast<size_t>(index));
+    }
+
     if (refresh)
       ui::OnHistoryChange();
   }
@@ -299,6 +676,9 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
   bool needs_refresh = false;
 
   for (size_t i = 0; i < items.size(); i++) {
+    // Updates in progress are kept until we receive a response
+    if (&items.at(i) == FindItemInProgress(items.at(i).anime_id))
+      continue;
     if (!items.at(i).enabled) {
       items.erase(items.begin() + i);
       needs_refresh = true;
@@ -306,6 +686,9 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
     }
   }
 
+  if (needs_refresh)
+    RebuildIndex();
+
   if (refresh && needs_refresh)
     ui::OnHistoryChange();
 
@@ -313,15 +696,92 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
     history->Save();
 }
 
+void HistoryQueue::RebuildIndex() {
+  // Items may have been reordered, so they are numbered again, and updates in
+  // progress are made to refer to the new numbers of their items. Those whose
+  // items are gone refer to none.
+  std::map<int, QWORD> in_progress;
+  foreach_(it, in_progress_)
+    in_progress[it->first] = static_cast<QWORD>(-1);
+
+  next_sequence_ = 0;
+  pending_updates_.clear();
+
+  for (size_t i = 0; i < items.size(); i++) {
+    HistoryItem& item = items.at(i);
+    auto it = in_progress_.find(item.anime_id);
+    if (it != in_progress_.end() && it->second == item.sequence)
+      in_progress[item.anime_id] = next_sequence_;
+    item.sequence = next_sequence_++;
+    if (item.enabled &&
+        item.mode != taiga::kHttpServiceAddLibraryEntry &&
+        item.mode != taiga::kHttpServiceDeleteLibraryEntry)
+      pending_updates_[item.anime_id] = item.sequence;
+  }
+
+  std::swap(in_progress_, in_progress);
+}
+
+HistoryItem* HistoryQueue::FindItemBySequence(QWORD sequence) {
+  auto it = std::lower_bound(items.begin(), items.end(), sequence,
+      [](const HistoryItem& item, QWORD sequence) {
+        return item.sequence < sequence;
+      });
+
+  if (it == items.end() || it->sequence != sequence)
+    return nullptr;
+
+  return &(*it);
+}
+
+HistoryItem* HistoryQueue::FindPendingUpdate(int anime_id) {
+  for (int pass = 0; pass < 2; pass++) {
+    auto it = pending_updates_.find(anime_id);
+    if (it == pending_updates_.end())
+      return nullptr;
+
+    HistoryItem* item = FindItemBySequence(it->second);
+    if (item && item->anime_id == anime_id && item->enabled &&
+        item->mode != taiga::kHttpServiceAddLibraryEntry &&
+        item->mode != taiga::kHttpServiceDeleteLibraryEntry)
+      return item;
+
+    // The item might have been disabled or moved since it was indexed
+    RebuildIndex();
+  }
+
+  return nullptr;
+}
+
+void HistoryQueue::IndexPendingUpdate(int anime_id, size_t position) {
+  // Looks for the most recent enabled update before the given position
+  while (position > 0) {
+    const HistoryItem& item = items.at(--position);
+    if (item.anime_id == anime_id && item.enabled &&
+        item.mode != taiga::kHttpServiceAddLibraryEntry &&
+        item.mode != taiga::kHttpServiceDeleteLibraryEntry) {
+      pending_updates_[anime_id] = item.sequence;
+      return;
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-History::History()
-    : limit(0) {  // Limit of history items (0 for unlimited)
+History::History() {
   queue.history = this;
 }
 
+void History::AddItem(const HistoryItem& item) {
+  items.Append(item);
+
+  if (!log.Append(item))
+    LOG(LevelError, L"Could not append to history log.");
+}
+
 void History::Clear(bool save) {
-  items.clear();
+  items.Clear();
+  log.Clear();
 
   ui::OnHistoryChange();
 
@@ -330,45 +790,103 @@ void History::Clear(bool save) {
 }
 
 bool History::Load() {
-  items.clear();
-  queue.items.clear();
+  items.Clear();
+  queue.Reset();
+
+  // Items
+  bool log_loaded = log.Load(taiga::GetPath(taiga::kPathUserHistoryLog));
+  if (log_loaded)
+    ReadItemsFromLog();
 
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathUserHistory);
   xml_parse_result parse_result = document.load_file(path.c_str());
 
   if (parse_result.status != pugi::status_ok)
-    return false;
+    return log_loaded;
 
   // Meta
   xml_node node_meta = document.child(L"meta");
   base::SemanticVersion version(XmlReadStrValue(node_meta, L"version"));
 
-  // Items
+  // Previous versions kept the items in the same file as the queue, so we
+  // move them to the log on the first run. The most recent items are still
+  // written to the file so that those versions can read them, and anything
+  // they have added after the last item of the log is appended to it.
+  if (!log_loaded) {
+    ReadItems(document);
+    std::vector<HistoryLogRecord> records;
+    for (size_t i = 0; i < items.size(); i++)
+      records.push_back(HistoryLogRecord(items.at(i)));
+    if (!log.Reset(records))
+      LOG(LevelError, L"Could not create history log.");
+  } else {
+    ReadNewItems(document);
+  }
+
+  // Queue events
+  if (version < base::SemanticVersion(1, 1, 4)) {
+    ReadQueueInCompatibilityMode(document);
+  } else {
+    ReadQueue(document);
+  }
+
+  return true;
+}
+
+void History::ReadItems(const pugi::xml_document& document) {
   xml_node node_items = document.child(L"history").child(L"items");
+
   foreach_xmlnode_(item, node_items, L"item") {
     HistoryItem history_item;
     history_item.anime_id = item.attribute(L"anime_id").as_int(anime::ID_NOTINLIST);
     history_item.episode = item.attribute(L"episode").as_int();
-    history_item.time = item.attribute(L"time").value();
+    history_item.time = ToTimestamp(item.attribute(L"time").value());
 
     if (AnimeDatabase.FindItem(history_item.anime_id)) {
-      items.push_back(history_item);
+      items.Append(history_item);
     } else {
       LOG(LevelWarning, L"Item does not exist in the database.\n"
                         L"ID: " + ToWstr(history_item.anime_id) + L"\n"
                         L"Episode: " + ToWstr(*history_item.episode) + L"\n"
-                        L"Time: " + history_item.time);
+                        L"Time: " + item.attribute(L"time").value());
     }
   }
-  // Queue events
-  if (version < base::SemanticVersion(1, 1, 4)) {
-    ReadQueueInCompatibilityMode(document);
-  } else {
-    ReadQueue(document);
+}
+
+void History::ReadNewItems(const pugi::xml_document& document) {
+  xml_node node_items = document.child(L"history").child(L"items");
+  time_t last_time = log.records().empty() ? 0 : log.records().back().time;
+
+  foreach_xmlnode_(item, node_items, L"item") {
+    HistoryItem history_item;
+    history_item.time = ToTimestamp(item.attribute(L"time").value());
+    if (history_item.time <= last_time)
+      continue;
+    history_item.anime_id = item.attribute(L"anime_id").as_int(anime::ID_NOTINLIST);
+    history_item.episode = item.attribute(L"episode").as_int();
+
+    if (AnimeDatabase.FindItem(history_item.anime_id))
+      AddItem(history_item);
   }
+}
 
-  return true;
+void History::ReadItemsFromLog() {
+  foreach_c_(it, log.records()) {
+    HistoryItem history_item;
+    history_item.anime_id = it->anime_id;
+    history_item.episode = it->episode;
+    history_item.time = it->time;
+
+    if (AnimeDatabase.FindItem(history_item.anime_id)) {
+      items.Append(history_item);
+    } else {
+      LOG(LevelWarning, L"Item does not exist in the database.\n"
+                        L"ID: " + ToWstr(history_item.anime_id) + L"\n"
+                        L"Episode: " + ToWstr(it->episode) + L"\n"
+                        L"Time: " + ToDateTimeString(it->time));
+    }
+  }
 }
 
 void History::ReadQueue(const pugi::xml_document& document) {
@@ -379,7 +897,7 @@ void History::ReadQueue(const pugi::xml_document& document) {
 
     history_item.anime_id = item.attribute(L"anime_id").as_int(anime::ID_NOTINLIST);
     history_item.mode = TranslateModeFromString(item.attribute(L"mode").value());
-    history_item.time = item.attribute(L"time").value();
+    history_item.time = ToTimestamp(item.attribute(L"time").value());
 
     #define READ_ATTRIBUTE_INT(x, y) \
         if (!item.attribute(y).empty()) x = item.attribute(y).as_int();
@@ -417,7 +935,7 @@ void History::ReadQueueInCompatibilityMode(const pugi::xml_document& document) {
 
     history_item.anime_id = item.attribute(L"anime_id").as_int(anime::ID_NOTINLIST);
     history_item.mode = item.attribute(L"mode").as_int();
-    history_item.time = item.attribute(L"time").value();
+    history_item.time = ToTimestamp(item.attribute(L"time").value());
 
     #define READ_ATTRIBUTE_INT(x, y) \
         if (!item.attribute(y).empty()) x = item.attribute(y).as_int();
@@ -438,7 +956,7 @@ void History::ReadQueueInCompatibilityMode(const pugi::xml_document& document) {
     #undef READ_ATTRIBUTE_STR
     #undef READ_ATTRIBUTE_INT
 
-    Date date_item(history_item.time);
+    Date date_item = TimestampToDate(history_item.time);
     Date date_limit(L"2014-06-20");  // Release date of v1.1.0
     if (date_item < date_limit) {
       if (history_item.mode == 3) {         // HTTP_MAL_AnimeAdd
@@ -459,9 +977,37 @@ void History::ReadQueueInCompatibilityMode(const pugi::xml_document& document) {
   }
 }
 
+void History::RemoveItem(size_t index) {
+  if (index >= items.size())
+    return;
+
+  log.Erase(items.at(index));
+  items.Erase(index);
+}
+
+bool History::ExportToXml(const std::wstring& path, time_t begin, time_t end) {
+  std::vector<HistoryLogRecord> records;
+  log.GetItems(begin, end, records);
+
+  return WriteDocument(path, records);
+}
+
 bool History::Save() {
+  // Only the most recent items are written for previous versions, which keep
+  // them in this file. The log is authoritative, and is appended to as items
+  // are added.
+  const auto& records = log.records();
+  size_t count = min(records.size(), kHistoryCompatibilityItemLimit);
+  std::vector<HistoryLogRecord> recent_records(records.end() - count,
+                                               records.end());
+
+  return WriteDocument(taiga::GetPath(taiga::kPathUserHistory),
+                       recent_records);
+}
+
+bool History::WriteDocument(const std::wstring& path,
+                            const std::vector<HistoryLogRecord>& records) {
   xml_document document;
-  std::wstring path = taiga::GetPath(taiga::kPathUserHistory);
 
   // Write meta
   xml_node node_meta = document.append_child(L"meta");
@@ -472,11 +1018,11 @@ bool History::Save() {
 
   // Write items
   xml_node node_items = node_history.append_child(L"items");
-  foreach_(it, items) {
+  foreach_c_(it, records) {
     xml_node node_item = node_items.append_child(L"item");
     node_item.append_attribute(L"anime_id") = it->anime_id;
-    node_item.append_attribute(L"episode") = *it->episode;
-    node_item.append_attribute(L"time") = it->time.c_str();
+    node_item.append_attribute(L"episode") = it->episode;
+    node_item.append_attribute(L"time") = ToDateTimeString(it->time).c_str();
   }
   // Write queue
   xml_node node_queue = node_history.append_child(L"queue");
@@ -490,7 +1036,7 @@ bool History::Save() {
         if (y) node_item.append_attribute(x) = std::wstring(*y).c_str();
     node_item.append_attribute(L"anime_id") = it->anime_id;
     node_item.append_attribute(L"mode") = TranslateModeToString(it->mode).c_str();
-    node_item.append_attribute(L"time") = it->time.c_str();
+    node_item.append_attribute(L"time") = ToDateTimeString(it->time).c_str();
     APPEND_ATTRIBUTE_INT(L"episode", it->episode);
     APPEND_ATTRIBUTE_INT(L"score", it->score);
     APPEND_ATTRIBUTE_INT(L"status", it->status);
@@ -19,14 +19,20 @@
 #ifndef TAIGA_LIBRARY_HISTORY_H
 #define TAIGA_LIBRARY_HISTORY_H
 
-#include <string>
+#include <limits>
+#include <map>
 #include <queue>
+#include <set>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/optional.h"
 #include "base/time.h"
+#include "base/types.h"
 #include "base/xml.h"
 #include "library/anime_episode.h"
+#include "library/history_log.h"
 
 enum QueueSearchMode {
   kQueueSearchDateStart = 1,
@@ -58,10 +64,72 @@ public:
   int anime_id;
   int mode;
   std::wstring reason;
-  std::wstring time;
+  time_t time;
+  // Assigned by the update queue in the order that items are added, which
+  // lets the queue find an item without keeping track of its position
+  QWORD sequence;
+};
+
+// Watched episodes are kept in a ring buffer, so that appending a new item
+// never shifts the existing ones, and the oldest items are evicted in constant
+// time once the buffer is full.
+
+class HistoryBuffer {
+public:
+  HistoryBuffer();
+  ~HistoryBuffer() {}
+
+  void Append(const HistoryItem& item);
+  void Clear();
+  void Erase(size_t index);
+
+  // Items are indexed from the oldest (0) to the newest (size() - 1)
+  const HistoryItem& at(size_t index) const;
+  bool empty() const;
+  size_t size() const;
+
+  // Returns up to count items, from the newest to the oldest
+  void GetRecentItems(size_t count,
+                      std::vector<const HistoryItem*>& items) const;
+
+private:
+  void Grow();
+  void RemoveOldest();
+
+  size_t count_;
+  size_t head_;
+  size_t limit_;
+  std::vector<HistoryItem> slots_;
 };
 
 class History;
+class HistoryQueue;
+
+// A transaction gathers changes to many list entries, so that they can be
+// validated at once, and then added to the queue with a single save and UI
+// refresh. If any of the changes is invalid, none of them is applied. Nothing
+// is applied before Commit, so discarding a transaction only drops the changes
+// it has gathered.
+
+class HistoryTransaction {
+public:
+  HistoryTransaction(HistoryQueue& queue);
+  ~HistoryTransaction() {}
+
+  void Add(const HistoryItem& item);
+  bool Commit();
+  void Discard();
+
+  const std::wstring& error() const;
+  size_t size() const;
+
+private:
+  bool Validate(const HistoryItem& item);
+
+  std::wstring error_;
+  std::vector<HistoryItem> items_;
+  HistoryQueue& queue_;
+};
 
 class HistoryQueue {
 public:
@@ -70,17 +138,61 @@ public:
 
   void Add(HistoryItem& item, bool save = true);
   void Check(bool automatic = true);
+  void CheckRetries();
   void Clear(bool save = true);
   HistoryItem* FindItem(int anime_id, int search_mode = 0);
+  HistoryItem* FindItemInProgress(int anime_id);
   HistoryItem* GetCurrentItem();
   int GetItemCount();
+  void HandleUpdateCancel(int anime_id);
+  void HandleUpdateError(int anime_id);
+  void HandleUpdateSuccess(int anime_id);
+  bool IsInProgress(int anime_id) const;
   void Remove(int index = -1, bool save = true, bool refresh = true, bool to_history = true);
   void RemoveDisabled(bool save = true, bool refresh = true);
+  // Forgets every item along with the state of updates, e.g. before the queue
+  // of another user is loaded
+  void Reset();
+
+  // Must be called after modifying items without using the functions above
+  void RebuildIndex();
 
   size_t index;
   std::vector<HistoryItem> items;
   History* history;
+  size_t max_simultaneous_updates;
   bool updating;
+
+private:
+  struct RetryState {
+    int attempts;
+    time_t next_attempt;
+  };
+
+  void Dispatch();
+  void FlushCompleted();
+  HistoryItem* FindItemBySequence(QWORD sequence);
+  HistoryItem* FindPendingUpdate(int anime_id);
+  void IndexPendingUpdate(int anime_id, size_t position);
+
+  // Updates are sent for several anime at once, but never for the same anime
+  // until its previous update is complete, so that they are applied in order.
+  // Maps an anime ID to the sequence number of the item that was sent, which
+  // is the one that is completed when the response arrives.
+  std::map<int, QWORD> in_progress_;
+  std::map<int, RetryState> retries_;
+
+  // Completed updates are applied to the list right away, but the list is
+  // saved and refreshed only once no more updates are in progress, so that a
+  // batch of updates doesn't cause a save and refresh for each of its items.
+  std::vector<int> completed_;
+
+  // Maps an anime ID to the sequence number of its most recent enabled update,
+  // which is where new values for the same anime are merged into. Sequence
+  // numbers increase along the queue, so an item is found with a binary
+  // search, and removing items anywhere in the queue keeps the index valid.
+  QWORD next_sequence_;
+  std::unordered_map<int, QWORD> pending_updates_;
 };
 
 class History {
@@ -88,20 +200,31 @@ public:
   History();
   ~History() {}
 
+  void AddItem(const HistoryItem& item);
   void Clear(bool save = true);
+  // Writes the items of the log within [begin, end) in the format of the
+  // history file, along with the queue
+  bool ExportToXml(const std::wstring& path, time_t begin = 0,
+                   time_t end = (std::numeric_limits<time_t>::max)());
   bool Load();
+  void RemoveItem(size_t index);
   bool Save();
 
-  std::vector<HistoryItem> items;
+  HistoryBuffer items;
+  HistoryLog log;
   HistoryQueue queue;
-  int limit;
 
 private:
+  void ReadItems(const pugi::xml_document& document);
+  void ReadItemsFromLog();
+  void ReadNewItems(const pugi::xml_document& document);
   void ReadQueue(const pugi::xml_document& document);
   void ReadQueueInCompatibilityMode(const pugi::xml_document& document);
 
   int TranslateModeFromString(const std::wstring& mode);
   std::wstring TranslateModeToString(int mode);
+  bool WriteDocument(const std::wstring& path,
+                     const std::vector<HistoryLogRecord>& records);
 };
 
 class ConfirmationQueue {
@@ -0,0 +1,305 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "library/history.h"
+#include "library/history_log.h"
+
+// File layout: "TGHL", format version (4 bytes), followed by records
+const char kHistoryLogSignature[] = {'T', 'G', 'H', 'L'};
+const unsigned int kHistoryLogVersion = 1;
+const size_t kHistoryLogHeaderSize = 8;
+// Time (8 bytes), anime ID (4 bytes), episode (4 bytes)
+const size_t kHistoryLogRecordSize = 16;
+
+HistoryLogRecord::HistoryLogRecord()
+    : time(0), anime_id(0), episode(0) {
+}
+
+HistoryLogRecord::HistoryLogRecord(const HistoryItem& item)
+    : time(item.time),
+      anime_id(item.anime_id),
+      episode(item.episode ? *item.episode : 0) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void WriteRecord(const HistoryLogRecord& record, std::string& output) {
+  __int64 time = record.time;
+  output.append(reinterpret_cast<const char*>(&time), sizeof(time));
+  output.append(reinterpret_cast<const char*>(&record.anime_id),
+                sizeof(record.anime_id));
+  output.append(reinterpret_cast<const char*>(&record.episode),
+                sizeof(record.episode));
+}
+
+static void ReadRecord(const char* data, HistoryLogRecord& record) {
+  __int64 time = 0;
+  memcpy(&time, data, sizeof(time));
+  memcpy(&record.anime_id, data + 8, sizeof(record.anime_id));
+  memcpy(&record.episode, data + 12, sizeof(record.episode));
+  record.time = static_cast<time_t>(time);
+}
+
+// Returns the number of days since 1970-01-01 in local time, which is used as
+// the key of daily buckets.
+static int GetDayNumber(time_t time, Date& date) {
+  tm t;
+  if (localtime_s(&t, &time) != 0)
+    return 0;
+
+  date = Date(t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+
+  // See: http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+  int y = date.month <= 2 ? date.year - 1 : date.year;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (date.month + (date.month > 2 ? -3 : 9)) + 2) / 5 +
+            date.day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool HistoryLog::Load(const std::wstring& path) {
+  path_ = path;
+  records_.clear();
+  buckets_.clear();
+
+  std::string data;
+  if (!ReadFromFile(path_, data))
+    return false;
+
+  if (data.size() < kHistoryLogHeaderSize ||
+      data.compare(0, 4, kHistoryLogSignature, 4) != 0) {
+    LOG(LevelError, L"Invalid history log: " + path_);
+    return false;
+  }
+
+  unsigned int version = 0;
+  memcpy(&version, data.data() + 4, sizeof(version));
+  if (version > kHistoryLogVersion) {
+    LOG(LevelError, L"Unsupported history log version: " + ToWstr(version));
+    return false;
+  }
+
+  // A partial record at the end can only be the result of an interrupted
+  // write, so it is ignored.
+  size_t record_count =
+      (data.size() - kHistoryLogHeaderSize) / kHistoryLogRecordSize;
+  records_.resize(record_count);
+  for (size_t i = 0; i < record_count; i++) {
+    ReadRecord(data.data() + kHistoryLogHeaderSize + i * kHistoryLogRecordSize,
+               records_.at(i));
+  }
+
+  // Records are appended in chronological order, except when the system clock
+  // has been changed
+  std::stable_sort(records_.begin(), records_.end(),
+      [](const HistoryLogRecord& a, const HistoryLogRecord& b) {
+        return a.time < b.time;
+      });
+
+  BuildIndex();
+
+  return true;
+}
+
+bool HistoryLog::Append(const HistoryItem& item) {
+  HistoryLogRecord record(item);
+
+  if (records_.empty() || records_.back().time <= record.time) {
+    records_.push_back(record);
+    IndexRecord(records_.size() - 1);
+  } else {
+    auto it = std::upper_bound(records_.begin(), records_.end(), record,
+        [](const HistoryLogRecord& a, const HistoryLogRecord& b) {
+          return a.time < b.time;
+        });
+    records_.insert(it, record);
+    BuildIndex();
+  }
+
+  if (path_.empty())
+    return false;
+
+  // Write the header first if this is a new file
+  if (!FileExists(path_))
+    return Write();
+
+  std::string data;
+  WriteRecord(record, data);
+
+  std::ofstream stream;
+  stream.open(path_, std::ofstream::app |
+                     std::ios::binary |
+                     std::ofstream::out);
+  if (!stream.is_open())
+    return false;
+  stream.write(data.c_str(), data.size());
+  stream.close();
+
+  return true;
+}
+
+bool HistoryLog::Clear() {
+  records_.clear();
+  buckets_.clear();
+
+  return Write();
+}
+
+bool HistoryLog::Erase(const HistoryItem& item) {
+  HistoryLogRecord record(item);
+
+  // Removing a record requires the whole file to be rewritten, which is fine
+  // as it is only done on user request.
+  for (size_t i = LowerBound(record.time); i < records_.size(); i++) {
+    const HistoryLogRecord& it = records_.at(i);
+    if (it.time != record.time)
+      break;
+    if (it.anime_id == record.anime_id && it.episode == record.episode) {
+      records_.erase(records_.begin() + i);
+      BuildIndex();
+      return Write();
+    }
+  }
+
+  return false;
+}
+
+bool HistoryLog::Reset(const std::vector<HistoryLogRecord>& records) {
+  records_ = records;
+  std::stable_sort(records_.begin(), records_.end(),
+      [](const HistoryLogRecord& a, const HistoryLogRecord& b) {
+        return a.time < b.time;
+      });
+
+  BuildIndex();
+
+  return Write();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t HistoryLog::CountItems(time_t begin, time_t end) const {
+  if (begin >= end)
+    return 0;
+
+  return LowerBound(end) - LowerBound(begin);
+}
+
+void HistoryLog::GetDailyCounts(time_t begin, time_t end,
+                                std::map<Date, int>& counts) const {
+  if (begin >= end || records_.empty())
+    return;
+
+  Date date;
+  auto it = buckets_.lower_bound(GetDayNumber(begin, date));
+  auto it_end = buckets_.upper_bound(GetDayNumber(end, date));
+
+  for ( ; it != it_end; ++it) {
+    const Bucket& bucket = it->second;
+    size_t count = bucket.count;
+    // Buckets at both ends of the range may only be partially included
+    const HistoryLogRecord& first = records_.at(bucket.first);
+    const HistoryLogRecord& last = records_.at(bucket.first + bucket.count - 1);
+    if (first.time < begin || last.time >= end) {
+      size_t bucket_end = bucket.first + bucket.count;
+      size_t range_begin = max(LowerBound(begin), bucket.first);
+      size_t range_end = min(LowerBound(end), bucket_end);
+      count = range_end > range_begin ? range_end - range_begin : 0;
+    }
+    if (count > 0)
+      counts[bucket.date] += static_cast<int>(count);
+  }
+}
+
+void HistoryLog::GetItems(time_t begin, time_t end,
+                          std::vector<HistoryLogRecord>& records) const {
+  if (begin >= end)
+    return;
+
+  size_t range_end = LowerBound(end);
+  for (size_t i = LowerBound(begin); i < range_end; i++)
+    records.push_back(records_.at(i));
+}
+
+const std::vector<HistoryLogRecord>& HistoryLog::records() const {
+  return records_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void HistoryLog::BuildIndex() {
+  buckets_.clear();
+
+  for (size_t i = 0; i < records_.size(); i++)
+    IndexRecord(i);
+}
+
+void HistoryLog::IndexRecord(size_t position) {
+  Date date;
+  int day = GetDayNumber(records_.at(position).time, date);
+
+  auto it = buckets_.find(day);
+  if (it == buckets_.end()) {
+    Bucket& bucket = buckets_[day];
+    bucket.date = date;
+    bucket.first = position;
+    bucket.count = 1;
+  } else {
+    it->second.count++;
+  }
+}
+
+size_t HistoryLog::LowerBound(time_t time) const {
+  HistoryLogRecord record;
+  record.time = time;
+
+  auto it = std::lower_bound(records_.begin(), records_.end(), record,
+      [](const HistoryLogRecord& a, const HistoryLogRecord& b) {
+        return a.time < b.time;
+      });
+
+  return it - records_.begin();
+}
+
+bool HistoryLog::Write() const {
+  if (path_.empty())
+    return false;
+
+  std::string data(kHistoryLogSignature, 4);
+  data.append(reinterpret_cast<const char*>(&kHistoryLogVersion),
+              sizeof(kHistoryLogVersion));
+  data.reserve(kHistoryLogHeaderSize +
+               records_.size() * kHistoryLogRecordSize);
+
+  foreach_c_(it, records_)
+    WriteRecord(*it, data);
+
+  return SaveToFile(data, path_);
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_LIBRARY_HISTORY_LOG_H
+#define TAIGA_LIBRARY_HISTORY_LOG_H
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/time.h"
+
+class HistoryItem;
+
+// The history log is an append-only binary file, in which every watched
+// episode is stored as a fixed-size record. Records are kept in chronological
+// order in memory, along with an index of daily buckets, so that time-based
+// queries don't have to go through the whole history.
+
+class HistoryLogRecord {
+public:
+  HistoryLogRecord();
+  HistoryLogRecord(const HistoryItem& item);
+
+  time_t time;
+  int anime_id;
+  int episode;
+};
+
+class HistoryLog {
+public:
+  HistoryLog() {}
+  ~HistoryLog() {}
+
+  bool Load(const std::wstring& path);
+  bool Append(const HistoryItem& item);
+  bool Clear();
+  bool Erase(const HistoryItem& item);
+  bool Reset(const std::vector<HistoryLogRecord>& records);
+
+  // Time ranges are half-open: [begin, end)
+  size_t CountItems(time_t begin, time_t end) const;
+  void GetDailyCounts(time_t begin, time_t end,
+                      std::map<Date, int>& counts) const;
+  void GetItems(time_t begin, time_t end,
+                std::vector<HistoryLogRecord>& records) const;
+
+  const std::vector<HistoryLogRecord>& records() const;
+
+private:
+  class Bucket {
+  public:
+    Date date;
+    size_t first;
+    size_t count;
+  };
+
+  void BuildIndex();
+  void IndexRecord(size_t position);
+  size_t LowerBound(time_t time) const;
+  bool Write() const;
+
+  std::map<int, Bucket> buckets_;
+  std::wstring path_;
+  std::vector<HistoryLogRecord> records_;
+};
+
+#endif  // TAIGA_LIBRARY_HISTORY_LOG_H
\ No newline at end of file
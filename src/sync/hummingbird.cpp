@@ -16,6 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <vector>
+
+#include "base/foreach.h"
 #include "base/http.h"
 #include "base/json.h"
 #include "base/string.h"
@@ -154,20 +157,57 @@ void Service::UpdateLibraryEntry(Request& request, HttpRequest& http_request) {
 // Response handlers
 
 void Service::AuthenticateUser(Response& response, HttpResponse& http_response) {
-  auth_token_ = http_response.body;
+  auth_token_ = StrToWstr(http_response.body);
   Trim(auth_token_, L"\"'");
 }
 
 void Service::GetLibraryEntries(Response& response, HttpResponse& http_response) {
-  Json::Value root;
+  // Library objects are parsed one at a time, but they are merged into the
+  // database only after the whole array has been read, so that a parse error
+  // leaves the current list intact
+  JsonArrayReader reader(http_response.body);
+  Json::Value value;
+
+  bool has_value = reader.Read(value);
+  if (reader.failed()) {
+    response.data[L"error"] = L"Could not parse the list";
+    return;
+  }
 
-  if (!ParseResponseBody(response, http_response, root))
+  // In delta mode, the list is kept as it is, and only the entries that were
+  // updated since the last download are applied
+  time_t delta_since = 0;
+  if (response.data.count(L"delta_since"))
+    delta_since = _wtoi64(response.data[L"delta_since"].c_str());
+
+  std::vector<Json::Value> values;
+  time_t last_updated = 0;
+
+  while (has_value) {
+    time_t entry_last_updated =
+        TranslateDateTimeFrom(StrToWstr(value["updated_at"].asString()));
+    if (entry_last_updated > last_updated)
+      last_updated = entry_last_updated;
+    if (!delta_since || !entry_last_updated ||
+        entry_last_updated >= delta_since) {
+      values.push_back(Json::Value());
+      values.back().swap(value);
+    }
+    has_value = reader.Read(value);
+  }
+
+  if (reader.failed()) {
+    response.data[L"error"] = L"Could not parse the list";
     return;
+  }
 
-  AnimeDatabase.ClearUserData();
+  if (!delta_since)
+    AnimeDatabase.ClearUserData();
+  foreach_(it, values)
+    ParseLibraryObject(*it);
 
-  for (size_t i = 0; i < root.size(); i++)
-    ParseLibraryObject(root[i]);
+  response.data[L"last_updated"] = ToWstr(static_cast<INT64>(last_updated));
+  response.data[L"updated_entries"] = ToWstr(static_cast<int>(values.size()));
 }
 
 void Service::GetMetadataById(Response& response, HttpResponse& http_response) {
@@ -264,8 +304,7 @@ bool Service::RequestSucceeded(Response& response,
     // Error
     default: {
       Json::Value root;
-      Json::Reader reader;
-      bool parsed = reader.parse(WstrToStr(http_response.body), root);
+      bool parsed = JsonParse(http_response.body, root);
       response.data[L"error"] = name() + L" returned an error: ";
       if (parsed) {
         response.data[L"error"] += StrToWstr(root["error"].asString());
@@ -342,6 +381,10 @@ void Service::ParseLibraryObject(Json::Value& value) {
   anime_item.SetMyLastWatchedEpisode(value["episodes_watched"].asInt());
   anime_item.SetMyStatus(TranslateMyStatusFrom(StrToWstr(value["status"].asString())));
   anime_item.SetMyRewatching(value["rewatching"].asBool());
+  time_t last_updated =
+      TranslateDateTimeFrom(StrToWstr(value["updated_at"].asString()));
+  if (last_updated)
+    anime_item.SetMyLastUpdated(ToWstr(static_cast<INT64>(last_updated)));
   anime_item.SetMyScore(TranslateMyRatingFrom(StrToWstr(rating_value["value"].asString()),
                                               StrToWstr(rating_value["type"].asString())));
 
@@ -350,9 +393,7 @@ void Service::ParseLibraryObject(Json::Value& value) {
 
 bool Service::ParseResponseBody(Response& response, HttpResponse& http_response,
                                 Json::Value& root) {
-  Json::Reader reader;
-
-  if (reader.parse(WstrToStr(http_response.body), root))
+  if (JsonParse(http_response.body, root))
     return true;
 
   switch (response.type) {
@@ -114,6 +114,22 @@ std::wstring TranslateDateFrom(const std::wstring& value) {
   return value.substr(0, 10);
 }
 
+time_t TranslateDateTimeFrom(const std::wstring& value) {
+  tm t = {0};
+
+  // Get epoch seconds from YYYY-MM-DDTHH:MM:SS.000Z, which is in UTC
+  if (swscanf_s(value.c_str(), L"%d-%d-%dT%d:%d:%d",
+                &t.tm_year, &t.tm_mon, &t.tm_mday,
+                &t.tm_hour, &t.tm_min, &t.tm_sec) != 6)
+    return 0;
+
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+
+  time_t result = _mkgmtime(&t);
+  return result > 0 ? result : 0;
+}
+
 int TranslateMyStatusFrom(const std::wstring& value) {
   if (IsEqual(value, L"currently-watching")) {
     return anime::kWatching;
@@ -19,6 +19,7 @@
 #ifndef TAIGA_SYNC_HUMMINGBIRD_UTIL_H
 #define TAIGA_SYNC_HUMMINGBIRD_UTIL_H
 
+#include <ctime>
 #include <string>
 
 namespace anime {
@@ -35,6 +36,7 @@ int TranslateSeriesStatusFrom(const std::wstring& value);
 int TranslateSeriesTypeFrom(int value);
 int TranslateSeriesTypeFrom(const std::wstring& value);
 std::wstring TranslateDateFrom(const std::wstring& value);
+time_t TranslateDateTimeFrom(const std::wstring& value);
 int TranslateMyRatingFrom(const std::wstring& value, const std::wstring& type);
 std::wstring TranslateMyRatingTo(int value);
 int TranslateMyStatusFrom(const std::wstring& value);
@@ -16,13 +16,17 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <vector>
+
 #include "base/foreach.h"
+#include "base/log.h"
 #include "base/string.h"
 #include "library/anime_db.h"
 #include "library/history.h"
 #include "sync/hummingbird.h"
 #include "sync/manager.h"
 #include "sync/myanimelist.h"
+#include "sync/prefetch.h"
 #include "sync/sync.h"
 #include "taiga/http.h"
 #include "taiga/settings.h"
@@ -33,7 +37,9 @@ sync::Manager ServiceManager;
 
 namespace sync {
 
-Manager::Manager() {
+Manager::Manager()
+    : handling_background_(false),
+      leaked_request_count_(0) {
   // Create services
   services_[kMyAnimeList].reset(new myanimelist::Service());
   services_[kHummingbird].reset(new hummingbird::Service());
@@ -78,65 +84,317 @@ string_t Manager::GetServiceNameById(ServiceId service_id) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Requests that have not received a response by then are considered to have
+// timed out. The time starts when a request is sent, except for the time it
+// may have to wait in the queue of the HTTP manager, which is limited apart.
+const time_t kRequestTimeout = 3 * 60;  // 3 minutes
+const time_t kRequestTimeoutLibrary = 10 * 60;  // 10 minutes
+const time_t kRequestQueueTimeout = 10 * 60;  // 10 minutes
+// Timed out and cancelled requests are kept a while longer, so that a late
+// response can be recognized and discarded
+const time_t kRequestGracePeriod = 60;  // 1 minute
+// Finished requests are reclaimed early if the registry grows beyond this
+const size_t kMaxRequestCount = 500;
+
+Manager::RequestEntry::RequestEntry()
+    : state(kRequestQueued), deadline(0) {
+}
+
+static time_t GetRequestTimeout(RequestType type) {
+  switch (type) {
+    // Libraries can be large, and are downloaded as a whole
+    case kGetLibraryEntries:
+      return kRequestTimeoutLibrary;
+    default:
+      return kRequestTimeout;
+  }
+}
+
 void Manager::MakeRequest(Request& request) {
+  win::Lock lock(critical_section_);
+
+  ReclaimRequests(time(nullptr));
+
+  if (handling_background_) {
+    request.data[L"background"] = L"true";
+  } else if (!request.data.count(L"background")) {
+    MetadataPrefetcher.OnUserRequest();
+  }
+
   foreach_(service, services_) {
     if (request.service_id == kAllServices ||
         request.service_id == service->first) {
       // Create a new HTTP request, and store its UID alongside the service
       // request until we receive a response
       HttpRequest http_request;
-      requests_.insert(std::make_pair(http_request.uid, request));
+      RequestEntry& entry = requests_[http_request.uid];
+      entry.request = request;
 
       // Make sure we store the actual service ID
       if (request.service_id == kAllServices)
-        requests_[http_request.uid].service_id = service->first;
+        entry.request.service_id = service->first;
 
       // Let the service build the HTTP request
       service->second->BuildRequest(request, http_request);
+      http_request.cancellation_token = cancellation_tokens_[service->first];
 
-      // Make the request
+      entry.state = kRequestQueued;
+      entry.deadline = time(nullptr) + kRequestQueueTimeout;
+
+      // Make the request, which may be sent right away
       ConnectionManager.MakeRequest(http_request,
                                     RequestTypeToClientMode(request.type));
     }
   }
 }
 
+void Manager::CancelBackgroundRequests() {
+  win::Lock lock(critical_section_);
+
+  // Cancelling may remove the entries, so we work on a copy of their UIDs
+  std::vector<std::wstring> uids;
+  foreach_c_(it, requests_)
+    if (it->second.request.data.count(L"background") &&
+        (it->second.state == kRequestQueued ||
+         it->second.state == kRequestInFlight))
+      uids.push_back(it->first);
+
+  foreach_c_(uid, uids)
+    CancelRequest(*uid);
+}
+
+void Manager::CancelRequest(const std::wstring& uid) {
+  win::Lock lock(critical_section_);
+
+  auto it = requests_.find(uid);
+  if (it == requests_.end())
+    return;
+
+  RequestEntry& entry = it->second;
+  if (entry.state != kRequestQueued && entry.state != kRequestInFlight)
+    return;
+
+  entry.state = kRequestCancelled;
+  entry.deadline = time(nullptr) + kRequestGracePeriod;
+
+  ConnectionManager.CancelRequest(uid);
+}
+
+void Manager::CancelRequests(ServiceId service_id) {
+  win::Lock lock(critical_section_);
+
+  // Transfers are aborted as soon as they notice, and queued requests are
+  // dropped before they are sent
+  cancellation_tokens_[service_id].Cancel();
+  cancellation_tokens_[service_id] = base::http::CancellationToken();
+
+  time_t now = time(nullptr);
+
+  foreach_(it, requests_) {
+    RequestEntry& entry = it->second;
+    if (entry.request.service_id == service_id &&
+        (entry.state == kRequestQueued || entry.state == kRequestInFlight)) {
+      entry.state = kRequestCancelled;
+      entry.deadline = now + kRequestGracePeriod;
+    }
+  }
+}
+
+void Manager::CheckTimeouts() {
+  win::Lock lock(critical_section_);
+
+  time_t now = time(nullptr);
+
+  std::vector<std::wstring> expired_uids;
+  foreach_c_(it, requests_)
+    if ((it->second.state == kRequestQueued ||
+         it->second.state == kRequestInFlight) &&
+        it->second.deadline <= now)
+      expired_uids.push_back(it->first);
+
+  foreach_c_(uid, expired_uids) {
+    RequestEntry& entry = requests_[*uid];
+    entry.state = kRequestTimedOut;
+    entry.deadline = now + kRequestGracePeriod;
+
+    // Handlers may make new requests, so we work on a copy. Cancelling may
+    // also remove the entry, if the request had not been sent yet.
+    Request request = entry.request;
+
+    LOG(LevelWarning, L"Request timed out. ID: " + *uid);
+    ConnectionManager.CancelRequest(*uid);
+
+    Response response;
+    response.service_id = request.service_id;
+    response.type = request.type;
+    response.data[L"error"] = L"Request timed out.";
+
+    handling_background_ = request.data.count(L"background") > 0;
+    HandleError(request, response);
+    handling_background_ = false;
+  }
+
+  ReclaimRequests(now);
+}
+
+void Manager::HandleHttpSend(const std::wstring& uid) {
+  win::Lock lock(critical_section_);
+
+  auto it = requests_.find(uid);
+  if (it == requests_.end() || it->second.state != kRequestQueued)
+    return;
+
+  it->second.state = kRequestInFlight;
+  it->second.deadline = time(nullptr) +
+                        GetRequestTimeout(it->second.request.type);
+}
+
+void Manager::HandleHttpCancel(HttpResponse& http_response) {
+  win::Lock lock(critical_section_);
+
+  // Cancelled requests are dropped without being handled, so that they cannot
+  // change any state. Library updates still give up their place in the queue,
+  // so that they can be sent again.
+  auto it = requests_.find(http_response.uid);
+  if (it == requests_.end())
+    return;
+
+  LOG(LevelDebug, L"Request was cancelled. ID: " + http_response.uid);
+  Request request = it->second.request;
+  requests_.erase(it);
+
+  switch (request.type) {
+    case kAddLibraryEntry:
+    case kDeleteLibraryEntry:
+    case kUpdateLibraryEntry:
+      History.queue.HandleUpdateCancel(ToInt(request.data[L"taiga-id"]));
+      break;
+  }
+}
+
 void Manager::HandleHttpError(HttpResponse& http_response, string_t error) {
   win::Lock lock(critical_section_);
 
-  const Request& request = requests_[http_response.uid];
+  Request request;
+  if (!BeginResponse(http_response.uid, request))
+    return;
 
   Response response;
   response.service_id = request.service_id;
   response.type = request.type;
   response.data[L"error"] = error;
 
-  HandleError(response, http_response);
+  handling_background_ = request.data.count(L"background") > 0;
+  HandleError(request, response);
+  handling_background_ = false;
 
-  // FIXME: Not thread-safe. Invalidates iterators on other threads.
-//requests_.erase(http_response.uid);
+  requests_.erase(http_response.uid);
 }
 
 void Manager::HandleHttpResponse(HttpResponse& http_response) {
   win::Lock lock(critical_section_);
 
-  const Request& request = requests_[http_response.uid];
+  Request request;
+  if (!BeginResponse(http_response.uid, request))
+    return;
 
   Response response;
   response.service_id = request.service_id;
   response.type = request.type;
+  if (request.data.count(L"delta_since"))
+    response.data[L"delta_since"] = request.data[L"delta_since"];
+
+  handling_background_ = request.data.count(L"background") > 0;
+  HandleResponse(request, response, http_response);
+  handling_background_ = false;
+
+  requests_.erase(http_response.uid);
+}
+
+size_t Manager::GetBackgroundRequestCount(ServiceId service_id) {
+  win::Lock lock(critical_section_);
+
+  size_t count = 0;
+  foreach_c_(it, requests_)
+    if (it->second.request.service_id == service_id &&
+        it->second.request.data.count(L"background") &&
+        (it->second.state == kRequestQueued ||
+         it->second.state == kRequestInFlight))
+      count++;
+
+  return count;
+}
+
+size_t Manager::GetLiveRequestCount() {
+  win::Lock lock(critical_section_);
 
-  HandleResponse(response, http_response);
+  size_t count = 0;
+  foreach_c_(it, requests_)
+    if (it->second.state == kRequestQueued ||
+        it->second.state == kRequestInFlight)
+      count++;
 
-  // FIXME: Not thread-safe. Invalidates iterators on other threads.
-//requests_.erase(http_response.uid);
+  return count;
+}
+
+size_t Manager::GetRequestCount() {
+  win::Lock lock(critical_section_);
+
+  return requests_.size();
+}
+
+size_t Manager::GetLeakedRequestCount() {
+  win::Lock lock(critical_section_);
+
+  return leaked_request_count_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void Manager::HandleError(Response& response, HttpResponse& http_response) {
-  Request& request = requests_[http_response.uid];
+bool Manager::BeginResponse(const std::wstring& uid, Request& request) {
+  auto it = requests_.find(uid);
+
+  if (it == requests_.end()) {
+    LOG(LevelWarning, L"Unknown request. ID: " + uid);
+    return false;
+  }
+
+  switch (it->second.state) {
+    case kRequestTimedOut:
+    case kRequestCancelled:
+      LOG(LevelDebug, L"Discarding late response. ID: " + uid);
+      requests_.erase(it);
+      return false;
+  }
+
+  // Handlers may make new requests, so we work on a copy
+  it->second.state = kRequestCompleted;
+  request = it->second.request;
 
+  return true;
+}
+
+void Manager::ReclaimRequests(time_t now) {
+  bool over_limit = requests_.size() > kMaxRequestCount;
+
+  for (auto it = requests_.begin(); it != requests_.end(); ) {
+    const RequestEntry& entry = it->second;
+    bool finished = entry.state == kRequestTimedOut ||
+                    entry.state == kRequestCancelled;
+    if (finished && (over_limit || entry.deadline <= now)) {
+      // The HTTP client never reported back for this request
+      LOG(LevelDebug, L"Reclaiming request. ID: " + it->first);
+      leaked_request_count_++;
+      requests_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Manager::HandleError(Request& request, Response& response) {
   int anime_id = ::anime::ID_UNKNOWN;
   if (request.data.count(L"taiga-id"))
     anime_id = ToInt(request.data[L"taiga-id"]);
@@ -167,8 +425,8 @@ void Manager::HandleError(Response& response, HttpResponse& http_response) {
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry:
-      History.queue.updating = false;
       ui::OnLibraryUpdateFailure(anime_id, response.data[L"error"]);
+      History.queue.HandleUpdateError(anime_id);
       break;
     default:
       ui::ChangeStatusText(response.data[L"error"]);
@@ -176,19 +434,18 @@ void Manager::HandleError(Response& response, HttpResponse& http_response) {
   }
 }
 
-void Manager::HandleResponse(Response& response, HttpResponse& http_response) {
+void Manager::HandleResponse(Request& request, Response& response,
+                             HttpResponse& http_response) {
   // Let the service do its thing
   Service& service = *services_[response.service_id].get();
   service.HandleResponse(response, http_response);
 
   // Check for error
   if (response.data.count(L"error")) {
-    HandleError(response, http_response);
+    HandleError(request, response);
     return;
   }
 
-  Request& request = requests_[http_response.uid];
-
   int anime_id = ::anime::ID_UNKNOWN;
   if (request.data.count(L"taiga-id"))
     anime_id = ToInt(request.data[L"taiga-id"]);
@@ -234,8 +491,18 @@ void Manager::HandleResponse(Response& response, HttpResponse& http_response) {
     }
 
     case kGetLibraryEntries: {
+      time_t last_updated = _wtoi64(response.data[L"last_updated"].c_str());
+      if (last_updated > AnimeDatabase.last_updated)
+        AnimeDatabase.last_updated = last_updated;
+      if (response.data.count(L"delta_since")) {
+        ui::ChangeStatusText(L"Successfully synchronized the list. "
+                             L"Updated entries: " +
+                             response.data[L"updated_entries"]);
+      } else {
+        AnimeDatabase.last_reconciled = time(nullptr);
+        ui::ChangeStatusText(L"Successfully downloaded the list.");
+      }
       AnimeDatabase.SaveList();
-      ui::ChangeStatusText(L"Successfully downloaded the list.");
       ui::OnLibraryChange();
       break;
     }
@@ -243,13 +510,8 @@ void Manager::HandleResponse(Response& response, HttpResponse& http_response) {
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry: {
-      History.queue.updating = false;
       ui::ClearStatusText();
-
-      auto history_item = History.queue.GetCurrentItem();
-      if (history_item)
-        AnimeDatabase.UpdateItem(*history_item);
-
+      History.queue.HandleUpdateSuccess(anime_id);
       break;
     }
   }
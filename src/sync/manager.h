@@ -19,6 +19,7 @@
 #ifndef TAIGA_SYNC_MANAGER_H
 #define TAIGA_SYNC_MANAGER_H
 
+#include <ctime>
 #include <map>
 #include <memory>
 #include <string>
@@ -29,6 +30,14 @@
 
 namespace sync {
 
+enum RequestState {
+  kRequestQueued,
+  kRequestInFlight,
+  kRequestCompleted,
+  kRequestTimedOut,
+  kRequestCancelled
+};
+
 // The service manager handles all the communication between services and the
 // application.
 
@@ -38,9 +47,20 @@ public:
   ~Manager();
 
   void MakeRequest(Request& request);
+  void CancelBackgroundRequests();
+  void CancelRequest(const std::wstring& uid);
+  void CancelRequests(ServiceId service_id);
+  void CheckTimeouts();
+  void HandleHttpCancel(HttpResponse& http_response);
+  void HandleHttpSend(const std::wstring& uid);
   void HandleHttpError(HttpResponse& http_response, string_t error);
   void HandleHttpResponse(HttpResponse& http_response);
 
+  size_t GetBackgroundRequestCount(ServiceId service_id);
+  size_t GetLiveRequestCount();
+  size_t GetRequestCount();
+  size_t GetLeakedRequestCount();
+
   const Service* service(ServiceId service_id);
   const Service* service(const string_t& canonical_name);
 
@@ -48,11 +68,29 @@ public:
   string_t GetServiceNameById(ServiceId service_id);
 
 private:
-  void HandleError(Response& response, HttpResponse& http_response);
-  void HandleResponse(Response& response, HttpResponse& http_response);
+  // Each service request is kept in the registry until its response has been
+  // handled, or until it expires without one.
+  struct RequestEntry {
+    RequestEntry();
+    Request request;
+    RequestState state;
+    time_t deadline;
+  };
+
+  bool BeginResponse(const std::wstring& uid, Request& request);
+  void ReclaimRequests(time_t now);
+
+  void HandleError(Request& request, Response& response);
+  void HandleResponse(Request& request, Response& response, HttpResponse& http_response);
 
+  // Shared by every request of a service, so that they can be cancelled at once
+  std::map<ServiceId, base::http::CancellationToken> cancellation_tokens_;
   win::CriticalSection critical_section_;
-  std::map<std::wstring, Request> requests_;
+  // Set while the response of a background request is being handled, so that
+  // any follow-up requests are made in the background as well
+  bool handling_background_;
+  size_t leaked_request_count_;
+  std::map<std::wstring, RequestEntry> requests_;
   std::map<ServiceId, std::unique_ptr<Service>> services_;
 };
 
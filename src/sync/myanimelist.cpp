@@ -16,7 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <map>
 #include <set>
+#include <vector>
 
 #include "base/base64.h"
 #include "base/foreach.h"
@@ -24,6 +26,7 @@
 #include "base/http.h"
 #include "base/string.h"
 #include "base/xml.h"
+#include "base/xml_reader.h"
 #include "library/anime_db.h"
 #include "library/anime_item.h"
 #include "library/anime_util.h"
@@ -33,6 +36,33 @@
 namespace sync {
 namespace myanimelist {
 
+// Reads the text of each child element of the current element. Values of the
+// previous call are cleared rather than removed, so that their memory can be
+// reused.
+static bool ReadChildValues(XmlReader& reader,
+                            std::map<std::string, std::string>& values) {
+  foreach_(it, values)
+    it->second.clear();
+
+  size_t depth = reader.depth();
+
+  while (true) {
+    switch (reader.Read()) {
+      case XmlReader::kNodeElementStart:
+        if (!reader.ReadElementText(values[reader.name()]))
+          return false;
+        break;
+      case XmlReader::kNodeElementEnd:
+        if (reader.depth() < depth)
+          return true;
+        break;
+      case XmlReader::kNodeEnd:
+      case XmlReader::kNodeError:
+        return false;
+    }
+  }
+}
+
 Service::Service() {
   host_ = L"myanimelist.net";
 
@@ -201,19 +231,22 @@ void Service::UpdateLibraryEntry(Request& request, HttpRequest& http_request) {
 
 void Service::AuthenticateUser(Response& response, HttpResponse& http_response) {
   response.data[canonical_name_ + L"-username"] =
-      InStr(http_response.body, L"<username>", L"</username>");
+      InStr(http_response.GetWideBody(), L"<username>", L"</username>");
 }
 
 void Service::GetLibraryEntries(Response& response, HttpResponse& http_response) {
-  xml_document document;
-  xml_parse_result parse_result = document.load(http_response.body.c_str());
+  // The list is read directly from the UTF-8 buffer, and each item is merged
+  // into the database as soon as it is complete, so that we never hold a copy
+  // of the whole document.
+  XmlReader reader(http_response.body);
 
-  if (parse_result.status != pugi::status_ok) {
+  if (!reader.ReadToElement("myanimelist") ||
+      !reader.ReadToElement("myinfo")) {
     response.data[L"error"] = L"Could not parse the list";
     return;
   }
 
-  xml_node node_myanimelist = document.child(L"myanimelist");
+  std::map<std::string, std::string> values;
 
   // Available tags:
   // - user_id
@@ -224,13 +257,32 @@ void Service::GetLibraryEntries(Response& response, HttpResponse& http_response)
   // - user_dropped
   // - user_plantowatch
   // - user_days_spent_watching
-  xml_node node_myinfo = node_myanimelist.child(L"myinfo");
-  user_.id = XmlReadStrValue(node_myinfo, L"user_id");
-  user_.username = XmlReadStrValue(node_myinfo, L"user_name");
+  if (!ReadChildValues(reader, values)) {
+    response.data[L"error"] = L"Could not parse the list";
+    return;
+  }
+  user_.id = StrToWstr(values["user_id"]);
+  user_.username = StrToWstr(values["user_name"]);
   // We ignore the remaining tags, because MAL can be very slow at updating
   // their values, and we can easily calculate them ourselves anyway.
 
-  AnimeDatabase.ClearUserData();
+  // In delta mode, the list is kept as it is, and only the entries that were
+  // updated since the last download are applied
+  time_t delta_since = 0;
+  if (response.data.count(L"delta_since"))
+    delta_since = _wtoi64(response.data[L"delta_since"].c_str());
+
+  // Entries are applied only after the whole list has been read, so that a
+  // parse error leaves the current list intact
+  std::vector<::anime::Item> anime_items;
+  time_t last_updated = 0;
+
+  auto read_int = [&](const char* name) {
+    return ToInt(values[name]);
+  };
+  auto read_str = [&](const char* name) {
+    return StrToWstr(values[name]);
+  };
 
   // Available tags:
   // - series_animedb_id
@@ -252,34 +304,61 @@ void Service::GetLibraryEntries(Response& response, HttpResponse& http_response)
   // - my_rewatching_ep
   // - my_last_updated
   // - my_tags
-  foreach_xmlnode_(node, node_myanimelist, L"anime") {
+  bool parsed = true;
+  while (reader.ReadToElement("anime")) {
+    if (!ReadChildValues(reader, values)) {
+      parsed = false;
+      break;
+    }
+
+    time_t entry_last_updated = _atoi64(values["my_last_updated"].c_str());
+    if (entry_last_updated > last_updated)
+      last_updated = entry_last_updated;
+    if (delta_since && entry_last_updated &&
+        entry_last_updated < delta_since)
+      continue;
+
     ::anime::Item anime_item;
     anime_item.SetSource(this->id());
-    anime_item.SetId(XmlReadStrValue(node, L"series_animedb_id"), this->id());
+    anime_item.SetId(read_str("series_animedb_id"), this->id());
     anime_item.SetLastModified(time(nullptr));  // current time
 
-    anime_item.SetTitle(XmlReadStrValue(node, L"series_title"));
-    anime_item.SetSynonyms(XmlReadStrValue(node, L"series_synonyms"));
-    anime_item.SetType(TranslateSeriesTypeFrom(XmlReadIntValue(node, L"series_type")));
-    anime_item.SetEpisodeCount(XmlReadIntValue(node, L"series_episodes"));
-    anime_item.SetAiringStatus(TranslateSeriesStatusFrom(XmlReadIntValue(node, L"series_status")));
-    anime_item.SetDateStart(XmlReadStrValue(node, L"series_start"));
-    anime_item.SetDateEnd(XmlReadStrValue(node, L"series_end"));
-    anime_item.SetImageUrl(XmlReadStrValue(node, L"series_image"));
+    anime_item.SetTitle(read_str("series_title"));
+    anime_item.SetSynonyms(read_str("series_synonyms"));
+    anime_item.SetType(TranslateSeriesTypeFrom(read_int("series_type")));
+    anime_item.SetEpisodeCount(read_int("series_episodes"));
+    anime_item.SetAiringStatus(TranslateSeriesStatusFrom(read_int("series_status")));
+    anime_item.SetDateStart(read_str("series_start"));
+    anime_item.SetDateEnd(read_str("series_end"));
+    anime_item.SetImageUrl(read_str("series_image"));
 
     anime_item.AddtoUserList();
-    anime_item.SetMyLastWatchedEpisode(XmlReadIntValue(node, L"my_watched_episodes"));
-    anime_item.SetMyDateStart(XmlReadStrValue(node, L"my_start_date"));
-    anime_item.SetMyDateEnd(XmlReadStrValue(node, L"my_finish_date"));
-    anime_item.SetMyScore(XmlReadIntValue(node, L"my_score"));
-    anime_item.SetMyStatus(TranslateMyStatusFrom(XmlReadIntValue(node, L"my_status")));
-    anime_item.SetMyRewatching(XmlReadIntValue(node, L"my_rewatching"));
-    anime_item.SetMyRewatchingEp(XmlReadIntValue(node, L"my_rewatching_ep"));
-    anime_item.SetMyLastUpdated(XmlReadStrValue(node, L"my_last_updated"));
-    anime_item.SetMyTags(XmlReadStrValue(node, L"my_tags"));
-
-    AnimeDatabase.UpdateItem(anime_item);
+    anime_item.SetMyLastWatchedEpisode(read_int("my_watched_episodes"));
+    anime_item.SetMyDateStart(read_str("my_start_date"));
+    anime_item.SetMyDateEnd(read_str("my_finish_date"));
+    anime_item.SetMyScore(read_int("my_score"));
+    anime_item.SetMyStatus(TranslateMyStatusFrom(read_int("my_status")));
+    anime_item.SetMyRewatching(read_int("my_rewatching"));
+    anime_item.SetMyRewatchingEp(read_int("my_rewatching_ep"));
+    anime_item.SetMyLastUpdated(read_str("my_last_updated"));
+    anime_item.SetMyTags(read_str("my_tags"));
+
+    anime_items.push_back(anime_item);
   }
+
+  if (!parsed || reader.type() == XmlReader::kNodeError) {
+    response.data[L"error"] = L"Could not parse the list";
+    return;
+  }
+
+  if (!delta_since)
+    AnimeDatabase.ClearUserData();
+  foreach_c_(it, anime_items)
+    AnimeDatabase.UpdateItem(*it);
+
+  response.data[L"last_updated"] = ToWstr(static_cast<INT64>(last_updated));
+  response.data[L"updated_entries"] =
+      ToWstr(static_cast<int>(anime_items.size()));
 }
 
 void Service::GetMetadataById(Response& response, HttpResponse& http_response) {
@@ -295,21 +374,22 @@ void Service::GetMetadataById(Response& response, HttpResponse& http_response) {
   // - Rank
   // - Popularity
   // - Members
-  string_t id = InStr(http_response.body,
+  const std::wstring& body = http_response.GetWideBody();
+  string_t id = InStr(body,
       L"/anime/", L"/");
-  string_t title = InStr(http_response.body,
+  string_t title = InStr(body,
       L"class=\"hovertitle\">", L"</a>");
-  string_t genres = InStr(http_response.body,
+  string_t genres = InStr(body,
       L"Genres:</span> ", L"<br />");
-  string_t status = InStr(http_response.body,
+  string_t status = InStr(body,
       L"Status:</span> ", L"<br />");
-  string_t type = InStr(http_response.body,
+  string_t type = InStr(body,
       L"Type:</span> ", L"<br />");
-  string_t episodes = InStr(http_response.body,
+  string_t episodes = InStr(body,
       L"Episodes:</span> ", L"<br />");
-  string_t score = InStr(http_response.body,
+  string_t score = InStr(body,
       L"Score:</span> ", L"<br />");
-  string_t popularity = InStr(http_response.body,
+  string_t popularity = InStr(body,
       L"Popularity:</span> ", L"<br />");
 
   bool title_is_truncated = false;
@@ -347,7 +427,8 @@ void Service::GetMetadataById(Response& response, HttpResponse& http_response) {
 
 void Service::SearchTitle(Response& response, HttpResponse& http_response) {
   xml_document document;
-  xml_parse_result parse_result = document.load(http_response.body.c_str());
+  xml_parse_result parse_result =
+      document.load(http_response.GetWideBody().c_str());
 
   if (parse_result.status != pugi::status_ok) {
     response.data[L"error"] = L"Could not parse search results";
@@ -441,35 +522,37 @@ bool Service::RequestSucceeded(Response& response,
 
   switch (response.type) {
     case kAddLibraryEntry:
-      if (IsNumeric(http_response.body))
+      if (IsNumeric(http_response.GetWideBody()))
         return true;
-      if (InStr(http_response.body, L"This anime is already on your list") > -1)
+      if (InStr(http_response.GetWideBody(),
+                L"This anime is already on your list") > -1)
         return true;
       // TODO: Remove when MAL fixes its API
-      if (InStr(http_response.body, L"<title>201 Created</title>") > -1)
+      if (InStr(http_response.GetWideBody(),
+                L"<title>201 Created</title>") > -1)
         return true;
       break;
     case kAuthenticateUser:
-      if (InStr(http_response.body, L"<username>") > -1)
+      if (InStr(http_response.GetWideBody(), L"<username>") > -1)
         return true;
       break;
     case kDeleteLibraryEntry:
-      if (IsEqual(http_response.body, L"Deleted"))
+      if (IsEqual(http_response.GetWideBody(), L"Deleted"))
         return true;
       break;
     case kGetLibraryEntries:
-      if (InStr(http_response.body, L"<myanimelist>", 0, true) > -1 &&
-          InStr(http_response.body, L"<myinfo>", 0, true) > -1)
+      if (http_response.body.find("<myanimelist>") != std::string::npos &&
+          http_response.body.find("<myinfo>") != std::string::npos)
         return true;
       break;
     case kGetMetadataById:
-      if (!InStr(http_response.body, L"/anime/", L"/").empty())
+      if (!InStr(http_response.GetWideBody(), L"/anime/", L"/").empty())
         return true;
       break;
     case kSearchTitle:
       return true;
     case kUpdateLibraryEntry:
-      if (IsEqual(http_response.body, L"Updated"))
+      if (IsEqual(http_response.GetWideBody(), L"Updated"))
         return true;
       break;
   }
@@ -479,15 +562,21 @@ bool Service::RequestSucceeded(Response& response,
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry: {
-      std::wstring error_message = http_response.body;
+      std::wstring error_message = http_response.GetWideBody();
       Replace(error_message, L"</div><div>", L"\r\n");
       StripHtmlTags(error_message);
       response.data[L"error"] = error_message;
       break;
     }
-    case kGetLibraryEntries:
-      response.data[L"error"] = name() + L" returned an invalid response";
+    case kGetLibraryEntries: {
+      // e.g. <myanimelist><error>Invalid username</error></myanimelist>
+      std::wstring error_message =
+          InStr(http_response.GetWideBody(), L"<error>", L"</error>");
+      if (error_message.empty())
+        error_message = name() + L" returned an invalid response";
+      response.data[L"error"] = error_message;
       break;
+    }
     default:
       response.data[L"error"] = L"Request failed for an unknown reason";
       break;
@@ -0,0 +1,219 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "base/foreach.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "library/anime_db.h"
+#include "library/anime_util.h"
+#include "sync/manager.h"
+#include "sync/prefetch.h"
+#include "sync/sync.h"
+#include "taiga/settings.h"
+
+sync::Prefetcher MetadataPrefetcher;
+
+namespace sync {
+
+// Background requests are not made for a while after a user-initiated request
+const time_t kPauseDuration = 10;  // 10 seconds
+// The queue is rebuilt at most this often, as items become stale over time
+const time_t kRebuildInterval = 10 * 60;  // 10 minutes
+// Budgets for each host
+const size_t kMaxConcurrentRequests = 2;
+const size_t kMaxRequestsPerMinute = 10;
+// Number of recently viewed items to prioritize
+const size_t kMaxRecentlyViewed = 20;
+
+enum PrefetchPriority {
+  kPriorityRecentlyViewed = 1,
+  kPriorityWatching = 2,
+  kPriorityAiring = 4
+};
+
+bool Prefetcher::Entry::operator<(const Entry& entry) const {
+  // Items of the same priority are refreshed starting from the most stale
+  if (priority == entry.priority)
+    return last_modified > entry.last_modified;
+
+  return priority < entry.priority;
+}
+
+Prefetcher::Prefetcher()
+    : enabled(true),
+      prefetched_requests(0),
+      last_rebuild_(0),
+      last_user_request_(0) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Prefetcher::Tick() {
+  if (!enabled)
+    return;
+
+  time_t now = time(nullptr);
+
+  if (IsPaused(now))
+    return;
+
+  if (queue_.empty() && now - last_rebuild_ >= kRebuildInterval)
+    Rebuild(now);
+
+  if (queue_.empty())
+    return;
+
+  auto service_id = taiga::GetCurrentServiceId();
+  auto service = ServiceManager.service(service_id);
+  if (!service)
+    return;
+
+  HostBudget& budget = host_budgets_[service->host()];
+  while (!budget.request_times.empty() &&
+         now - budget.request_times.front() >= 60)
+    budget.request_times.pop_front();
+
+  while (!queue_.empty()) {
+    if (budget.request_times.size() >= kMaxRequestsPerMinute)
+      break;
+    if (ServiceManager.GetBackgroundRequestCount(service_id) >=
+        kMaxConcurrentRequests)
+      break;
+
+    Entry entry = queue_.top();
+    queue_.pop();
+
+    // The item might have been refreshed since the queue was built
+    auto anime_item = AnimeDatabase.FindItem(entry.anime_id);
+    if (!anime_item || !anime::MetadataNeedsRefresh(*anime_item))
+      continue;
+
+    GetMetadataById(entry.anime_id, true);
+
+    budget.request_times.push_back(now);
+    prefetched_requests++;
+  }
+}
+
+void Prefetcher::OnUserRequest() {
+  {
+    win::Lock lock(critical_section_);
+    last_user_request_ = time(nullptr);
+  }
+
+  // Background requests that are already being made would compete with the
+  // user's, so they are cancelled as well. Their items are still stale, and
+  // are queued again on the next rebuild.
+  ServiceManager.CancelBackgroundRequests();
+}
+
+void Prefetcher::OnViewed(int anime_id) {
+  {
+    win::Lock lock(critical_section_);
+
+    foreach_(it, recently_viewed_) {
+      if (*it == anime_id) {
+        recently_viewed_.erase(it);
+        break;
+      }
+    }
+
+    recently_viewed_.push_front(anime_id);
+    if (recently_viewed_.size() > kMaxRecentlyViewed)
+      recently_viewed_.pop_back();
+  }
+
+  // The item is queued right away with its new priority, rather than waiting
+  // for the next rebuild. If it is already in the queue, the identical request
+  // made for the other entry joins this one's transfer.
+  auto anime_item = AnimeDatabase.FindItem(anime_id);
+  if (anime_item && anime::MetadataNeedsRefresh(*anime_item)) {
+    Entry entry;
+    entry.anime_id = anime_id;
+    entry.priority = GetPriority(anime_id);
+    entry.last_modified = anime_item->GetLastModified();
+    queue_.push(entry);
+  }
+}
+
+bool Prefetcher::IsPaused(time_t now) {
+  win::Lock lock(critical_section_);
+
+  return now - last_user_request_ < kPauseDuration;
+}
+
+size_t Prefetcher::GetQueueSize() const {
+  return queue_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int Prefetcher::GetPriority(int anime_id) {
+  auto anime_item = AnimeDatabase.FindItem(anime_id);
+  if (!anime_item)
+    return 0;
+
+  int priority = 0;
+
+  if (anime_item->GetAiringStatus() == anime::kAiring)
+    priority |= kPriorityAiring;
+  if (anime_item->IsInList() &&
+      anime_item->GetMyStatus() == anime::kWatching)
+    priority |= kPriorityWatching;
+
+  win::Lock lock(critical_section_);
+  foreach_c_(it, recently_viewed_) {
+    if (*it == anime_id) {
+      priority |= kPriorityRecentlyViewed;
+      break;
+    }
+  }
+
+  return priority;
+}
+
+void Prefetcher::Rebuild(time_t now) {
+  std::priority_queue<Entry> queue;
+
+  foreach_(it, AnimeDatabase.items) {
+    anime::Item& anime_item = it->second;
+
+    int priority = GetPriority(anime_item.GetId());
+
+    // Other items in the database (e.g. season data) are left alone, unless
+    // they are relevant to the user
+    if (!priority && !anime_item.IsInList())
+      continue;
+    if (!anime::MetadataNeedsRefresh(anime_item))
+      continue;
+
+    Entry entry;
+    entry.anime_id = anime_item.GetId();
+    entry.priority = priority;
+    entry.last_modified = anime_item.GetLastModified();
+    queue.push(entry);
+  }
+
+  std::swap(queue_, queue);
+  last_rebuild_ = now;
+
+  if (!queue_.empty())
+    LOG(LevelDebug, L"Stale items: " + ToWstr(static_cast<int>(queue_.size())));
+}
+
+}  // namespace sync
\ No newline at end of file
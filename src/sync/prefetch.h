@@ -0,0 +1,85 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_SYNC_PREFETCH_H
+#define TAIGA_SYNC_PREFETCH_H
+
+#include <ctime>
+#include <deque>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "win/win_thread.h"
+
+namespace sync {
+
+// The prefetcher refreshes stale metadata in the background, so that it is
+// already up to date by the time it is displayed. Items that are airing,
+// being watched or were recently viewed are refreshed first. Requests are
+// issued within per-host budgets, and the prefetcher stays idle for a while
+// after any user-initiated request.
+
+class Prefetcher {
+public:
+  Prefetcher();
+  ~Prefetcher() {}
+
+  void Tick();
+
+  void OnUserRequest();
+  void OnViewed(int anime_id);
+
+  bool IsPaused(time_t now);
+  size_t GetQueueSize() const;
+
+  bool enabled;
+  unsigned int prefetched_requests;
+
+private:
+  class Entry {
+  public:
+    bool operator<(const Entry& entry) const;
+
+    int anime_id;
+    int priority;
+    time_t last_modified;
+  };
+
+  class HostBudget {
+  public:
+    std::deque<time_t> request_times;
+  };
+
+  int GetPriority(int anime_id);
+  void Rebuild(time_t now);
+
+  win::CriticalSection critical_section_;
+  std::map<std::wstring, HostBudget> host_budgets_;
+  time_t last_rebuild_;
+  time_t last_user_request_;
+  std::priority_queue<Entry> queue_;
+  std::deque<int> recently_viewed_;
+};
+
+}  // namespace sync
+
+extern sync::Prefetcher MetadataPrefetcher;
+
+#endif  // TAIGA_SYNC_PREFETCH_H
\ No newline at end of file
@@ -33,6 +33,25 @@
 
 namespace sync {
 
+// The whole list is downloaded and reconciled on demand, or if it was last done
+// longer ago than this. Otherwise, only the entries that were updated since the
+// last download are applied, and entries removed by other clients are kept
+// until then.
+const time_t kFullSynchronizationInterval = 24 * 60 * 60;  // 24 hours
+
+// Remembered until the list is downloaded, as we may need to log in first
+static bool full_synchronization_requested = false;
+
+static bool IsDeltaSynchronizationPossible() {
+  if (full_synchronization_requested)
+    return false;
+  if (!AnimeDatabase.last_updated || !AnimeDatabase.last_reconciled)
+    return false;
+
+  return time(nullptr) - AnimeDatabase.last_reconciled <
+         kFullSynchronizationInterval;
+}
+
 void AuthenticateUser(bool download) {
   if (!taiga::GetCurrentUsername().empty() &&
       !taiga::GetCurrentPassword().empty()) {
@@ -62,15 +81,24 @@ void GetLibraryEntries() {
   SetActiveServiceForRequest(request);
   if (!AddAuthenticationToRequest(request))
     return;
+  // Neither service accepts a "since" parameter, so the whole list is still
+  // downloaded. The mark only limits which entries are applied to the list.
+  if (IsDeltaSynchronizationPossible()) {
+    request.data[L"delta_since"] =
+        ToWstr(static_cast<INT64>(AnimeDatabase.last_updated));
+  }
+  full_synchronization_requested = false;
   ServiceManager.MakeRequest(request);
 }
 
-void GetMetadataById(int id) {
+void GetMetadataById(int id, bool background) {
   Request request(kGetMetadataById);
   SetActiveServiceForRequest(request);
   if (!AddAuthenticationToRequest(request))
     return;
   AddServiceDataToRequest(request, id);
+  if (background)
+    request.data[L"background"] = L"true";
   ServiceManager.MakeRequest(request);
 }
 
@@ -96,7 +124,10 @@ void SearchTitle(string_t title, int id) {
   ServiceManager.MakeRequest(request);
 }
 
-void Synchronize() {
+void Synchronize(bool full) {
+  if (full)
+    full_synchronization_requested = true;
+
   if (!Taiga.logged_in) {
     AuthenticateUser(true);
   } else if (History.queue.GetItemCount() == 0) {
@@ -106,14 +137,14 @@ void Synchronize() {
   }
 }
 
-void UpdateLibraryEntry(AnimeValues& anime_values, int id,
+bool UpdateLibraryEntry(AnimeValues& anime_values, int id,
                         taiga::HttpClientMode http_client_mode) {
   RequestType request_type = ClientModeToRequestType(http_client_mode);
 
   Request request(request_type);
   SetActiveServiceForRequest(request);
   if (!AddAuthenticationToRequest(request))
-    return;
+    return false;
   AddServiceDataToRequest(request, id);
 
   if (anime_values.episode)
@@ -132,6 +163,7 @@ void UpdateLibraryEntry(AnimeValues& anime_values, int id,
     request.data[L"tags"] = *anime_values.tags;
 
   ServiceManager.MakeRequest(request);
+  return true;
 }
 
 void DownloadImage(int id, const string_t& image_url) {
@@ -170,10 +202,12 @@ bool AddServiceDataToRequest(Request& request, int id) {
   if (!anime_item)
     return false;
 
+  // The item might not have an ID for the current service yet, if it came from
+  // another one
   request.data[ServiceManager.service(kMyAnimeList)->canonical_name() + L"-id"] =
-      anime_item->GetId(kMyAnimeList);
+      AnimeDatabase.GetMappedId(id, kMyAnimeList);
   request.data[ServiceManager.service(kHummingbird)->canonical_name() + L"-id"] =
-      anime_item->GetId(kHummingbird);
+      AnimeDatabase.GetMappedId(id, kHummingbird);
 
   return true;
 }
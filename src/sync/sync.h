@@ -28,11 +28,11 @@ namespace sync {
 
 void AuthenticateUser(bool download);
 void GetLibraryEntries();
-void GetMetadataById(int id);
+void GetMetadataById(int id, bool background = false);
 void GetMetadataByIdV2(int id);
 void SearchTitle(string_t title, int id);
-void Synchronize();
-void UpdateLibraryEntry(AnimeValues& anime_values, int id,
+void Synchronize(bool full = false);
+bool UpdateLibraryEntry(AnimeValues& anime_values, int id,
                         taiga::HttpClientMode http_client_mode);
 
 void DownloadImage(int id, const std::wstring& image_url);
@@ -16,6 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <vector>
+
+#include "base/foreach.h"
 #include "base/log.h"
 #include "base/process.h"
 #include "base/string.h"
@@ -27,6 +30,7 @@
 #include "sync/myanimelist_util.h"
 #include "sync/sync.h"
 #include "taiga/announce.h"
+#include "taiga/path.h"
 #include "taiga/resource.h"
 #include "taiga/settings.h"
 #include "track/monitor.h"
@@ -43,6 +47,38 @@
 #include "ui/ui.h"
 #include "win/win_commondialog.h"
 
+// Returns the anime IDs that an action applies to. If a selection is passed in
+// wParam, all of its items are used, otherwise only the anime in lParam.
+static void GetActionTargets(WPARAM wParam, LPARAM lParam,
+                             std::vector<int>& anime_ids) {
+  auto selection = reinterpret_cast<const std::vector<int>*>(wParam);
+
+  if (selection && selection->size() > 1) {
+    anime_ids = *selection;
+  } else {
+    anime_ids.clear();
+    anime_ids.push_back(static_cast<int>(lParam));
+  }
+}
+
+// Changes to several anime are committed together, so that an invalid value
+// cancels all of them and the list is saved only once.
+static void AddHistoryItems(std::vector<HistoryItem>& history_items) {
+  if (history_items.empty())
+    return;
+
+  if (history_items.size() == 1) {
+    History.queue.Add(history_items.front());
+    return;
+  }
+
+  HistoryTransaction transaction(History.queue);
+  foreach_(it, history_items)
+    transaction.Add(*it);
+  if (!transaction.Commit())
+    ui::ChangeStatusText(transaction.error());
+}
+
 void ExecuteAction(std::wstring action, WPARAM wParam, LPARAM lParam) {
   LOG(LevelDebug, action);
 
@@ -70,13 +106,28 @@ void ExecuteAction(std::wstring action, WPARAM wParam, LPARAM lParam) {
   } else if (action == L"Exit" || action == L"Quit") {
     ui::DlgMain.Destroy();
 
+  // ExportHistory([path])
+  //   Exports the whole watch history to an XML file, in the format that
+  //   previous versions use. Exports next to the history file by default.
+  } else if (action == L"ExportHistory") {
+    if (body.empty())
+      body = AddTrailingSlash(GetPathOnly(
+                 taiga::GetPath(taiga::kPathUserHistory))) +
+             L"history_export.xml";
+    if (History.ExportToXml(body)) {
+      ui::ChangeStatusText(L"Exported history to " + body);
+    } else {
+      ui::ChangeStatusText(L"Could not export history to " + body);
+    }
+
   //////////////////////////////////////////////////////////////////////////////
   // Services
 
-  // Synchronize()
+  // Synchronize([full])
   //   Synchronizes local and remote lists.
+  //   Only recently updated entries are applied, unless "full" is specified.
   } else if (action == L"Synchronize") {
-    sync::Synchronize();
+    sync::Synchronize(body == L"full");
 
   // SearchAnime()
   } else if (action == L"SearchAnime") {
@@ -370,39 +421,54 @@ void ExecuteAction(std::wstring action, WPARAM wParam, LPARAM lParam) {
   // EditScore(value)
   //   Changes anime score.
   //   Value must be between 0-10 and different from current score.
+  //   wParam is an optional pointer to a vector of anime IDs.
   //   lParam is an anime ID.
   } else if (action == L"EditScore") {
-    int anime_id = static_cast<int>(lParam);
-    HistoryItem history_item;
-    history_item.anime_id = anime_id;
-    history_item.score = ToInt(body);
-    history_item.mode = taiga::kHttpServiceUpdateLibraryEntry;
-    History.queue.Add(history_item);
+    std::vector<int> anime_ids;
+    GetActionTargets(wParam, lParam, anime_ids);
+    std::vector<HistoryItem> history_items;
+    foreach_(it, anime_ids) {
+      HistoryItem history_item;
+      history_item.anime_id = *it;
+      history_item.score = ToInt(body);
+      history_item.mode = taiga::kHttpServiceUpdateLibraryEntry;
+      history_items.push_back(history_item);
+    }
+    AddHistoryItems(history_items);
 
   // EditStatus(value)
   //   Changes anime status of user.
   //   Value must be 1, 2, 3, 4 or 5, and different from current status.
+  //   wParam is an optional pointer to a vector of anime IDs.
   //   lParam is an anime ID.
   } else if (action == L"EditStatus") {
-    HistoryItem history_item;
-    history_item.status = ToInt(body);
-    int anime_id = static_cast<int>(lParam);
-    auto anime_item = AnimeDatabase.FindItem(anime_id);
-    switch (*history_item.status) {
-      case anime::kCompleted:
-        history_item.episode = anime_item->GetEpisodeCount();
-        if (*history_item.episode == 0)
-          history_item.episode.Reset();
-        if (!anime::IsValidDate(anime_item->GetMyDateStart()) &&
-            anime_item->GetEpisodeCount() == 1)
-          history_item.date_start = GetDate();
-        if (!anime::IsValidDate(anime_item->GetMyDateEnd()))
-          history_item.date_finish = GetDate();
-        break;
+    std::vector<int> anime_ids;
+    GetActionTargets(wParam, lParam, anime_ids);
+    std::vector<HistoryItem> history_items;
+    foreach_(it, anime_ids) {
+      HistoryItem history_item;
+      history_item.status = ToInt(body);
+      int anime_id = *it;
+      auto anime_item = AnimeDatabase.FindItem(anime_id);
+      if (!anime_item)
+        continue;
+      switch (*history_item.status) {
+        case anime::kCompleted:
+          history_item.episode = anime_item->GetEpisodeCount();
+          if (*history_item.episode == 0)
+            history_item.episode.Reset();
+          if (!anime::IsValidDate(anime_item->GetMyDateStart()) &&
+              anime_item->GetEpisodeCount() == 1)
+            history_item.date_start = GetDate();
+          if (!anime::IsValidDate(anime_item->GetMyDateEnd()))
+            history_item.date_finish = GetDate();
+          break;
+      }
+      history_item.anime_id = anime_id;
+      history_item.mode = taiga::kHttpServiceUpdateLibraryEntry;
+      history_items.push_back(history_item);
     }
-    history_item.anime_id = anime_id;
-    history_item.mode = taiga::kHttpServiceUpdateLibraryEntry;
-    History.queue.Add(history_item);
+    AddHistoryItems(history_items);
 
   // EditTags(tags)
   //   Changes anime tags.
@@ -16,9 +16,22 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "base/crc.h"
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/http_share.h"
 #include "base/string.h"
+#include "base/xml.h"
+#include "base/xml_reader.h"
 #include "library/anime_db.h"
+#include "library/history.h"
+#include "sync/manager.h"
+#include "sync/service.h"
+#include "sync/sync.h"
 #include "taiga/debug.h"
+#include "taiga/http.h"
+#include "taiga/settings.h"
+#include "taiga/taiga.h"
 #include "ui/dlg/dlg_main.h"
 #include "ui/dialog.h"
 
@@ -40,7 +53,7 @@ void Tester::Start() {
   value_ = li.QuadPart;
 }
 
-void Tester::End(std::wstring str, bool display_result) {
+double Tester::End(std::wstring str, bool display_result) {
   LARGE_INTEGER li;
 
   ::QueryPerformanceCounter(&li);
@@ -50,6 +63,8 @@ void Tester::End(std::wstring str, bool display_result) {
     str = ToWstr(value, 2) + L"ms | Text: [" + str + L"]";
     ui::DlgMain.SetText(str);
   }
+
+  return value;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -86,4 +101,577 @@ void Test() {
   test.End(str, 0);
 }
 
+void BenchmarkHistoryQueue(int item_count) {
+  // Simulates loading a long offline queue, where consecutive updates to the
+  // same anime are merged into each other. IDs are kept out of the database's
+  // range, so that the values are not validated against any list entry.
+  const int anime_count = max(item_count / 10, 1);
+  const int anime_id_offset = 1000000000;
+
+  HistoryQueue queue;
+
+  Tester test;
+  test.Start();
+
+  for (int i = 0; i < item_count; i++) {
+    HistoryItem history_item;
+    history_item.anime_id = anime_id_offset + (i % anime_count);
+    history_item.mode = taiga::kHttpServiceUpdateLibraryEntry;
+    if ((i / anime_count) % 2 == 0) {
+      history_item.episode = i / anime_count + 1;
+    } else {
+      history_item.score = i % 10 + 1;
+    }
+    queue.Add(history_item, false);
+  }
+
+  test.End(L"Added " + ToWstr(item_count) + L" items, " +
+           ToWstr(static_cast<int>(queue.items.size())) + L" in queue", true);
+}
+
+static void ProcessMessages() {
+  // Responses are handled on other threads, which may be waiting for the UI
+  MSG msg;
+  while (::PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+    ::TranslateMessage(&msg);
+    ::DispatchMessage(&msg);
+  }
+}
+
+void TestUpdateQueue(int anime_count, unsigned int latency,
+                     unsigned int failure_rate) {
+  // Sends updates through the queue to the HTTP fixture, which stands in for
+  // MyAnimeList with the given latency and rate of failed requests. Each list
+  // entry gets two updates, which set its episode back by one and then forward
+  // again, so the list is left as it was only if the updates of every anime
+  // were applied in order.
+  Tester test;
+  test.Start();
+
+  HistoryQueue& queue = History.queue;
+
+  if (taiga::GetCurrentServiceId() != sync::kMyAnimeList) {
+    test.End(L"MyAnimeList must be the active service", true);
+    return;
+  }
+  if (queue.updating || !queue.items.empty()) {
+    test.End(L"The queue must be empty", true);
+    return;
+  }
+
+  std::map<int, int> episodes;
+  foreach_c_(it, AnimeDatabase.items) {
+    if (static_cast<int>(episodes.size()) >= anime_count)
+      break;
+    if (it->second.IsInList() && it->second.GetMyLastWatchedEpisode() > 0)
+      episodes[it->first] = it->second.GetMyLastWatchedEpisode();
+  }
+
+  // Items are put in the queue as they are, because Add() would drop the
+  // values that are the same as the list's
+  for (int pass = 0; pass < 2; pass++) {
+    foreach_c_(it, episodes) {
+      HistoryItem history_item;
+      history_item.anime_id = it->first;
+      history_item.mode = taiga::kHttpServiceUpdateLibraryEntry;
+      history_item.episode = it->second - 1 + pass;
+      history_item.time = time(nullptr);
+      queue.items.push_back(history_item);
+    }
+  }
+  queue.RebuildIndex();
+  size_t update_count = queue.items.size();
+
+  taiga::HttpFixture& fixture = ConnectionManager.fixture;
+  taiga::HttpFixtureMode previous_mode = fixture.mode;
+  fixture.mode = taiga::kHttpFixtureReplay;
+  fixture.latency = latency;
+  fixture.failure_code = 0;
+  fixture.failure_rate = failure_rate;
+  fixture.default_code = 200;
+  fixture.default_body = "Updated";
+  unsigned int replayed = fixture.replayed;
+  unsigned int fast_failed = ConnectionManager.fast_failed_requests;
+
+  bool logged_in = Taiga.logged_in;
+  Taiga.logged_in = true;
+
+  // Failed updates are retried after a delay, and given up on after a few
+  // attempts, in which case the test runs out of time
+  const DWORD kTimeLimit = 10 * 60 * 1000;  // 10 minutes
+  DWORD start_time = ::GetTickCount();
+  queue.Check(false);
+  while (!queue.items.empty() && ::GetTickCount() - start_time < kTimeLimit) {
+    ProcessMessages();
+    queue.CheckRetries();
+    ::Sleep(10);
+  }
+
+  Taiga.logged_in = logged_in;
+  replayed = fixture.replayed - replayed;
+  fast_failed = ConnectionManager.fast_failed_requests - fast_failed;
+  fixture.mode = previous_mode;
+  fixture.latency = 0;
+  fixture.failure_rate = 0;
+  fixture.default_code = 0;
+  fixture.default_body.clear();
+
+  int changed_count = 0;
+  foreach_c_(it, episodes) {
+    auto anime_item = AnimeDatabase.FindItem(it->first);
+    if (!anime_item || anime_item->GetMyLastWatchedEpisode() != it->second)
+      changed_count++;
+  }
+
+  bool passed = queue.items.empty() && changed_count == 0;
+  test.End(std::wstring(passed ? L"Passed" : L"Failed") + L": " +
+           ToWstr(static_cast<int>(update_count)) + L" updates for " +
+           ToWstr(static_cast<int>(episodes.size())) + L" anime, " +
+           ToWstr(static_cast<int>(replayed)) + L" responses, " +
+           ToWstr(static_cast<int>(fast_failed)) + L" failed fast, " +
+           ToWstr(static_cast<int>(queue.items.size())) + L" left in queue, " +
+           ToWstr(changed_count) + L" entries changed", true);
+}
+
+void TestRequestRegistry(int request_count, unsigned int latency) {
+  // Makes metadata requests to the HTTP fixture, which holds on to each of them
+  // for the given latency, and cancels all of them while some are still queued
+  // and others are in flight. The HTTP manager must report back for every one
+  // of them, so that none is left for the service manager to reclaim.
+  Tester test;
+  test.Start();
+
+  if (ServiceManager.GetRequestCount() > 0) {
+    test.End(L"There must be no requests in progress", true);
+    return;
+  }
+
+  taiga::HttpFixture& fixture = ConnectionManager.fixture;
+  taiga::HttpFixtureMode previous_mode = fixture.mode;
+  fixture.mode = taiga::kHttpFixtureReplay;
+  fixture.latency = latency;
+  fixture.failure_rate = 0;
+  fixture.default_code = 200;
+  size_t leaked_count = ServiceManager.GetLeakedRequestCount();
+
+  int made_count = 0;
+  foreach_c_(it, AnimeDatabase.items) {
+    if (made_count >= request_count)
+      break;
+    sync::GetMetadataById(it->first, true);
+    made_count++;
+  }
+  size_t live_count = ServiceManager.GetLiveRequestCount();
+
+  ServiceManager.CancelRequests(taiga::GetCurrentServiceId());
+  size_t live_count_after_cancel = ServiceManager.GetLiveRequestCount();
+
+  // Transfers notice that they were cancelled once the fixture wakes up
+  const DWORD kTimeLimit = latency + 30 * 1000;
+  DWORD start_time = ::GetTickCount();
+  while (ServiceManager.GetRequestCount() > 0 &&
+         ::GetTickCount() - start_time < kTimeLimit) {
+    ProcessMessages();
+    ServiceManager.CheckTimeouts();
+    ::Sleep(10);
+  }
+
+  size_t remaining_count = ServiceManager.GetRequestCount();
+  leaked_count = ServiceManager.GetLeakedRequestCount() - leaked_count;
+  fixture.mode = previous_mode;
+  fixture.latency = 0;
+  fixture.default_code = 0;
+
+  bool passed = static_cast<int>(live_count) == made_count &&
+                live_count_after_cancel == 0 &&
+                remaining_count == 0 &&
+                leaked_count == 0;
+  test.End(std::wstring(passed ? L"Passed" : L"Failed") + L": " +
+           ToWstr(made_count) + L" requests, " +
+           ToWstr(static_cast<int>(live_count)) + L" live, " +
+           ToWstr(static_cast<int>(live_count_after_cancel)) +
+           L" live after cancelling, " +
+           ToWstr(static_cast<int>(remaining_count)) + L" remaining, " +
+           ToWstr(static_cast<int>(leaked_count)) + L" leaked", true);
+}
+
+void TestDeltaSynchronization() {
+  // Stands in for MyAnimeList with the user's list, in which no entry has been
+  // updated since the last download, and counts the bytes that a delta
+  // synchronization downloads against the entries that it applies. The request
+  // is made here with the mark, so that it cannot turn into a full download
+  // that would replace the list with the stand-in.
+  Tester test;
+  test.Start();
+
+  if (taiga::GetCurrentServiceId() != sync::kMyAnimeList) {
+    test.End(L"MyAnimeList must be the active service", true);
+    return;
+  }
+  if (ServiceManager.GetRequestCount() > 0) {
+    test.End(L"There must be no requests in progress", true);
+    return;
+  }
+
+  time_t delta_since = AnimeDatabase.last_updated ?
+                       AnimeDatabase.last_updated : time(nullptr);
+
+  std::string body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+                     "<myanimelist><myinfo><user_name>" +
+                     WstrToStr(taiga::GetCurrentUsername()) +
+                     "</user_name></myinfo>";
+  int entry_count = 0;
+  foreach_c_(it, AnimeDatabase.items) {
+    if (!it->second.IsInList())
+      continue;
+    body += "<anime><series_animedb_id>" +
+            WstrToStr(it->second.GetId(sync::kMyAnimeList)) +
+            "</series_animedb_id><my_last_updated>1</my_last_updated></anime>";
+    entry_count++;
+  }
+  body += "</myanimelist>";
+
+  taiga::HttpFixture& fixture = ConnectionManager.fixture;
+  taiga::HttpFixtureMode previous_mode = fixture.mode;
+  fixture.mode = taiga::kHttpFixtureReplay;
+  fixture.failure_rate = 0;
+  fixture.default_code = 200;
+  fixture.default_body = body;
+  unsigned int replayed = fixture.replayed;
+
+  time_t start_time = time(nullptr);
+
+  sync::Request request(sync::kGetLibraryEntries);
+  sync::SetActiveServiceForRequest(request);
+  if (sync::AddAuthenticationToRequest(request)) {
+    request.data[L"delta_since"] = ToWstr(static_cast<INT64>(delta_since));
+    ServiceManager.MakeRequest(request);
+  }
+
+  const DWORD kTimeLimit = 60 * 1000;  // 1 minute
+  DWORD start_tick = ::GetTickCount();
+  while (ServiceManager.GetRequestCount() > 0 &&
+         ::GetTickCount() - start_tick < kTimeLimit) {
+    ProcessMessages();
+    ::Sleep(10);
+  }
+
+  replayed = fixture.replayed - replayed;
+  fixture.mode = previous_mode;
+  fixture.default_code = 0;
+  fixture.default_body.clear();
+
+  int applied_count = 0;
+  foreach_c_(it, AnimeDatabase.items)
+    if (it->second.IsInList() && it->second.GetLastModified() >= start_time)
+      applied_count++;
+
+  bool passed = replayed == 1 && applied_count == 0;
+  test.End(std::wstring(passed ? L"Passed" : L"Failed") + L": " +
+           ToWstr(entry_count) + L" entries, " +
+           ToWstr(static_cast<int>(body.size() * replayed)) +
+           L" bytes downloaded, " +
+           ToWstr(applied_count) + L" entries applied", true);
+}
+
+void BenchmarkSynchronization(int run_count) {
+  // Downloads the list from responses that were recorded with -recordhttp,
+  // so that parsing and applying the list can be measured apart from the
+  // network. Requires the program to be started with -replayhttp.
+  Tester test;
+
+  if (ConnectionManager.fixture.mode != taiga::kHttpFixtureReplay) {
+    test.End(L"Must be started with -replayhttp", true);
+    return;
+  }
+  if (ServiceManager.GetRequestCount() > 0) {
+    test.End(L"There must be no requests in progress", true);
+    return;
+  }
+
+  taiga::HttpFixture& fixture = ConnectionManager.fixture;
+  unsigned int missed = fixture.missed;
+  unsigned int replayed = fixture.replayed;
+
+  test.Start();
+
+  const DWORD kTimeLimit = 60 * 1000;  // 1 minute
+  for (int i = 0; i < run_count; i++) {
+    sync::GetLibraryEntries();
+    DWORD start_time = ::GetTickCount();
+    while (ServiceManager.GetRequestCount() > 0 &&
+           ::GetTickCount() - start_time < kTimeLimit) {
+      ProcessMessages();
+      ::Sleep(0);
+    }
+  }
+
+  missed = fixture.missed - missed;
+  replayed = fixture.replayed - replayed;
+
+  test.End(ToWstr(run_count) + L" runs, " +
+           ToWstr(static_cast<int>(replayed)) + L" replayed, " +
+           ToWstr(static_cast<int>(missed)) + L" missed, " +
+           ToWstr(static_cast<int>(AnimeDatabase.items.size())) +
+           L" items in database", true);
+}
+
+void BenchmarkLibraryParser(int item_count) {
+  // Builds a MyAnimeList response of the given size, then reads every value
+  // of every entry, first from a DOM built on the decoded body (i.e. how the
+  // list used to be parsed), and then with the streaming reader.
+  const char* tags[] = {
+    "series_animedb_id", "series_title", "series_synonyms", "series_type",
+    "series_episodes", "series_status", "series_start", "series_end",
+    "series_image", "my_id", "my_watched_episodes", "my_start_date",
+    "my_finish_date", "my_score", "my_status", "my_rewatching",
+    "my_rewatching_ep", "my_last_updated", "my_tags"
+  };
+  const size_t tag_count = sizeof(tags) / sizeof(*tags);
+  std::wstring wide_tags[tag_count];
+  for (size_t j = 0; j < tag_count; j++)
+    wide_tags[j] = StrToWstr(tags[j]);
+
+  std::string body =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+      "<myanimelist><myinfo><user_id>1</user_id><user_name>Taiga</user_name>"
+      "</myinfo>\n";
+  for (int i = 0; i < item_count; i++) {
+    body += "\t<anime>\n";
+    for (size_t j = 0; j < tag_count; j++) {
+      body += "\t\t<" + std::string(tags[j]) + ">";
+      if (j == 1) {
+        body += "<![CDATA[Toradora! \xE3\x81\xA8\xE3\x82\x89\xE3\x83\x89\xE3"
+                "\x83\xA9 #" + ToStr(i) + "]]>";
+      } else if (j == 2) {
+        body += "Tiger &amp; Dragon; " + ToStr(i);
+      } else {
+        body += ToStr(i % 100 + static_cast<int>(j));
+      }
+      body += "</" + std::string(tags[j]) + ">\n";
+    }
+    body += "\t</anime>\n";
+  }
+  body += "</myanimelist>";
+
+  size_t value_count = 0;
+
+  Tester test_dom;
+  test_dom.Start();
+  {
+    std::wstring decoded_body = StrToWstr(body);
+    xml_document document;
+    document.load(decoded_body.c_str());
+    xml_node node_myanimelist = document.child(L"myanimelist");
+    foreach_xmlnode_(node, node_myanimelist, L"anime") {
+      for (size_t j = 0; j < tag_count; j++) {
+        std::wstring value = XmlReadStrValue(node, wide_tags[j].c_str());
+        value_count += !value.empty();
+      }
+    }
+  }
+  double time_dom = test_dom.End(L"", false);
+
+  Tester test_reader;
+  test_reader.Start();
+  {
+    XmlReader reader(body);
+    std::string value;
+    while (reader.ReadToElement("anime")) {
+      while (reader.Read() == XmlReader::kNodeElementStart) {
+        reader.ReadElementText(value);
+        value_count -= !StrToWstr(value).empty();
+      }
+    }
+  }
+
+  test_reader.End(ToWstr(item_count) + L" entries, " +
+                  ToWstr(static_cast<int>(body.size() / 1024)) + L" KB | " +
+                  L"DOM: " + ToWstr(time_dom, 2) + L"ms | " +
+                  L"Mismatched values: " +
+                  ToWstr(static_cast<int>(value_count)), true);
+}
+
+static size_t DiscardFunction(char*, size_t size, size_t count, void*) {
+  return size * count;
+}
+
+static int SessionReuseFunction(CURL*, curl_infotype type, char* data,
+                                size_t size, void* userptr) {
+  // curl does not report whether a TLS session was resumed, other than in its
+  // verbose output (OpenSSL and Schannel backends, respectively)
+  if (type == CURLINFO_TEXT) {
+    std::string text(data, size);
+    if (text.find("re-using session ID") != std::string::npos ||
+        text.find("re-using existing credential") != std::string::npos)
+      ++*reinterpret_cast<int*>(userptr);
+  }
+  return 0;
+}
+
+void BenchmarkSharedHandle(const std::wstring& url, int request_count) {
+  // Makes the same requests from a new easy handle each, as concurrent clients
+  // would, first with nothing shared between the handles and then through a
+  // share handle. Meant to be run against a local TLS server, such as:
+  //   openssl s_server -accept 4433 -www -cert cert.pem -key key.pem
+  std::string address = WstrToStr(url);
+  std::wstring result;
+  double separate_connect_time = 0.0;
+
+  for (int pass = 0; pass < 2; pass++) {
+    base::http::Share share;
+    CURLSH* share_handle = pass == 1 ? share.handle() : nullptr;
+
+    int connections = 0;
+    int handshakes = 0;
+    int resumed_sessions = 0;
+    int failures = 0;
+    double connect_time = 0.0;
+
+    Tester test;
+    test.Start();
+
+    for (int i = 0; i < request_count; i++) {
+      CURL* handle = curl_easy_init();
+      int reused = 0;
+      curl_easy_setopt(handle, CURLOPT_URL, address.c_str());
+      curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, DiscardFunction);
+      curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+      curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+      curl_easy_setopt(handle, CURLOPT_DEBUGFUNCTION, SessionReuseFunction);
+      curl_easy_setopt(handle, CURLOPT_DEBUGDATA, &reused);
+      curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
+      if (share_handle)
+        curl_easy_setopt(handle, CURLOPT_SHARE, share_handle);
+
+      if (curl_easy_perform(handle) == CURLE_OK) {
+        long new_connections = 0;
+        double app_connect_time = 0.0;
+        curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &new_connections);
+        curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &app_connect_time);
+        connections += new_connections;
+        // Every new connection makes a handshake, which is a full one unless
+        // a previous session is resumed
+        if (new_connections > 0) {
+          if (reused > 0) {
+            resumed_sessions++;
+          } else {
+            handshakes++;
+          }
+        }
+        connect_time += app_connect_time * 1000.0;
+      } else {
+        failures++;
+      }
+
+      curl_easy_cleanup(handle);
+    }
+
+    result += std::wstring(pass == 0 ? L"Separate: " : L" | Shared: ") +
+              ToWstr(connections) + L" connections, " +
+              ToWstr(handshakes) + L" full handshakes, " +
+              ToWstr(resumed_sessions) + L" resumed sessions, " +
+              ToWstr(connect_time, 2) + L"ms connecting, " +
+              ToWstr(failures) + L" failed";
+
+    if (pass == 0) {
+      separate_connect_time = connect_time;
+      result += L" (" + ToWstr(test.End(L"", false), 2) + L"ms)";
+    } else {
+      result += L" | Saved: " +
+                ToWstr(separate_connect_time - connect_time, 2) + L"ms";
+      test.End(result, true);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+class DownloadClient : public base::http::Client {
+public:
+  DownloadClient(HANDLE event)
+      : base::http::Client(base::http::Request()),
+        error(CURLE_OK), event_(event) {}
+
+  void OnCancel() { error = CURLE_ABORTED_BY_CALLBACK; ::SetEvent(event_); }
+  void OnError(CURLcode code) { error = code; ::SetEvent(event_); }
+  void OnReadComplete() {
+    error = CURLE_OK;
+    checksum = response().file_checksum;
+    ::SetEvent(event_);
+  }
+
+  CURLcode error;
+  std::wstring checksum;
+
+private:
+  HANDLE event_;
+};
+
+void TestResumableDownload(const std::wstring& url,
+                           const std::wstring& reference_path,
+                           int attempt_limit) {
+  // Downloads the same file as the reference file, starting over with a new
+  // request whenever the transfer is interrupted. Meant to be run against a
+  // local server that supports range requests and validators, and that drops
+  // the connection partway through each response body.
+  std::string reference;
+  if (!ReadFromFile(reference_path, reference)) {
+    Print(L"Could not read reference file: " + reference_path + L"\n");
+    return;
+  }
+  std::wstring reference_checksum = ConvertCrcValueToString(
+      UpdateCrc(0, reference.data(), reference.size()));
+
+  std::wstring download_path = reference_path + L".download";
+  ::DeleteFile(download_path.c_str());
+
+  win::Event event;
+  HANDLE event_handle = event.Create(nullptr, FALSE, FALSE, nullptr);
+  DownloadClient client(event_handle);
+
+  int attempts = 0;
+  int resumed_attempts = 0;
+
+  Tester test;
+  test.Start();
+
+  while (attempts < attempt_limit) {
+    base::http::Request request;
+    request.url = url;
+    if (GetFileSize(AtomicFileWriter::GetPartialPath(download_path)))
+      resumed_attempts++;
+
+    client.set_download_path(download_path);
+    attempts++;
+    if (!client.MakeRequest(request)) {
+      client.error = CURLE_FAILED_INIT;
+      break;
+    }
+
+    ::WaitForSingleObject(event_handle, INFINITE);
+    // The client is cleaned up right after the callback returns
+    while (client.busy())
+      ::Sleep(10);
+
+    if (client.error == CURLE_OK || client.error == CURLE_ABORTED_BY_CALLBACK)
+      break;
+  }
+
+  std::string downloaded;
+  ReadFromFile(download_path, downloaded);
+
+  bool passed = client.error == CURLE_OK &&
+                client.checksum == reference_checksum &&
+                downloaded == reference;
+
+  test.End(std::wstring(passed ? L"Passed" : L"Failed") + L": " +
+           ToWstr(attempts) + L" attempts, " +
+           ToWstr(resumed_attempts) + L" resumed, " +
+           ToWstr(static_cast<QWORD>(downloaded.size())) + L" of " +
+           ToWstr(static_cast<QWORD>(reference.size())) + L" bytes, " +
+           L"CRC " + client.checksum + L" (expected " +
+           reference_checksum + L")", true);
+}
+
 } // namespace debug
\ No newline at end of file
@@ -28,7 +28,7 @@ class Tester {
   Tester();
 
   void Start();
-  void End(std::wstring str, bool display_result);
+  double End(std::wstring str, bool display_result);
 
  private:
   double frequency_;
@@ -38,6 +38,19 @@ class Tester {
 void Print(std::wstring text);
 void Test();
 
+void BenchmarkHistoryQueue(int item_count = 50000);
+void TestUpdateQueue(int anime_count = 50, unsigned int latency = 200,
+                     unsigned int failure_rate = 20);
+void TestRequestRegistry(int request_count = 20, unsigned int latency = 2000);
+void TestDeltaSynchronization();
+void BenchmarkSynchronization(int run_count = 5);
+void BenchmarkLibraryParser(int item_count = 10000);
+void BenchmarkSharedHandle(const std::wstring& url = L"https://localhost:4433/",
+                           int request_count = 100);
+void TestResumableDownload(const std::wstring& url,
+                           const std::wstring& reference_path,
+                           int attempt_limit = 20);
+
 }  // namespace debug
 
 #endif  // TAIGA_TAIGA_DEBUG_H
\ No newline at end of file
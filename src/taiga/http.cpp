@@ -16,6 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdlib>
+
+#include "base/crc.h"
 #include "base/file.h"
 #include "base/foreach.h"
 #include "base/log.h"
@@ -24,8 +27,11 @@
 #include "library/anime_util.h"
 #include "library/resource.h"
 #include "sync/manager.h"
+#include "sync/prefetch.h"
 #include "taiga/announce.h"
 #include "taiga/http.h"
+#include "taiga/http_stats.h"
+#include "taiga/path.h"
 #include "taiga/settings.h"
 #include "taiga/stats.h"
 #include "taiga/taiga.h"
@@ -41,6 +47,24 @@ namespace taiga {
 const unsigned int kMaxSimultaneousConnections = 10;
 const unsigned int kMaxSimultaneousConnectionsPerHostname = 6;
 
+// Number of requests each priority class may dispatch in a round, while higher
+// classes have requests waiting. Lower classes are slowed down, but they are
+// never starved.
+const unsigned int kPriorityWeights[kHttpPriorityCount] = {8, 4, 2, 1, 1};
+
+// A host's circuit breaker opens after this many consecutive failures
+const unsigned int kBreakerThreshold = 5;
+// The breaker stays open for an exponentially growing delay, plus up to 20%
+// jitter, so that clients do not all come back at the same time
+const time_t kBreakerBaseDelay = 30;       // 30 seconds
+const time_t kBreakerMaxDelay = 15 * 60;  // 15 minutes
+
+// Finished clients keep their connections open for this long, which is within
+// the keep-alive timeout of most servers. Idle clients beyond the limit are
+// removed, least recently used first.
+const unsigned long kClientIdleTimeout = 60 * 1000;  // 60 seconds
+const size_t kMaxPooledClients = kMaxSimultaneousConnections * 2;
+
 HttpClient::HttpClient(const HttpRequest& request)
     : base::http::Client(request),
       mode_(kHttpSilent) {
@@ -73,20 +97,52 @@ void HttpClient::OnError(CURLcode error_code) {
   std::wstring error_text = L"HTTP error #" + ToWstr(error_code) + L": " +
                             StrToWstr(curl_easy_strerror(error_code));
   TrimRight(error_text, L"\r\n ");
+
+  // Only network errors count against the host's circuit breaker, as others
+  // (e.g. a write error or an aborted transfer) are our own
+  bool host_failure = false;
   switch (error_code) {
     case CURLE_COULDNT_RESOLVE_HOST:
     case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
       error_text += L" (" + request_.url.host + L")";
+      host_failure = true;
+      break;
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+      host_failure = true;
       break;
   }
 
   LOG(LevelError, error_text + L"\nConnection mode: " + ToWstr(mode_));
 
-  ui::OnHttpError(*this, error_text);
+  ui::OnHttpError(mode_, error_text);
 
   Stats.connections_failed++;
 
-  ConnectionManager.HandleError(response_, error_text);
+  HttpTimings timings;
+  timings.ReadTransferInfo(*this);
+  HttpClientMode mode = mode_;
+  std::wstring host = request_.url.host;
+
+  timings.StartProcessing();
+  ConnectionManager.HandleError(response_, error_text, host_failure);
+  timings.StopProcessing();
+
+  HttpStatistics.Record(mode, host, timings, error_code);
+}
+
+void HttpClient::OnCancel() {
+  HttpTimings timings;
+  timings.ReadTransferInfo(*this);
+  HttpClientMode mode = mode_;
+  std::wstring host = request_.url.host;
+
+  timings.StartProcessing();
+  ConnectionManager.HandleCancel(response_);
+  timings.StopProcessing();
+
+  HttpStatistics.Record(mode, host, timings, CURLE_ABORTED_BY_CALLBACK);
 }
 
 bool HttpClient::OnHeadersAvailable() {
@@ -102,6 +158,7 @@ bool HttpClient::OnRedirect(const std::wstring& address) {
       std::wstring path = GetPathOnly(Taiga.Updater.GetDownloadPath());
       std::wstring file = GetFileName(address);
       Taiga.Updater.SetDownloadPath(path + file);
+      set_download_path(Taiga.Updater.GetDownloadPath());
       break;
     }
   }
@@ -112,22 +169,127 @@ bool HttpClient::OnRedirect(const std::wstring& address) {
   return false;
 }
 
+bool HttpClient::OnValidateDownload(const std::string& head) {
+  switch (mode()) {
+    case kHttpFeedDownload:
+    case kHttpFeedDownloadAll: {
+      // The previous file is kept, if the server sent e.g. an error page
+      HttpResponse response = response_;
+      response.body = head;
+      return Aggregator.ValidateFeedDownload(request_, response);
+    }
+  }
+
+  return true;
+}
+
 bool HttpClient::OnProgress() {
   ui::OnHttpProgress(*this);
   return false;
 }
 
 void HttpClient::OnReadComplete() {
+  if (ConnectionManager.fixture.mode == kHttpFixtureRecord) {
+    std::string body = response_.body;
+    if (!response_.file.empty())
+      ReadFromFile(response_.file, body);
+    ConnectionManager.fixture.Record(request_, response_, body);
+  }
+
   ui::OnHttpReadComplete(*this);
 
   Stats.connections_succeeded++;
 
+  HttpTimings timings;
+  timings.ReadTransferInfo(*this);
+  HttpClientMode mode = mode_;
+  std::wstring host = request_.url.host;
+
+  timings.StartProcessing();
   ConnectionManager.HandleResponse(response_);
+  timings.StopProcessing();
+
+  HttpStatistics.Record(mode, host, timings);
+}
+
+bool HttpClient::SendRequest() {
+#ifdef TAIGA_HTTP_MULTITHREADED
+  // Replayed responses are served by Transfer(), which blocks
+  if (ConnectionManager.fixture.mode == kHttpFixtureReplay)
+    return CreateThread(nullptr, 0, 0);
+#endif
+
+  return base::http::Client::SendRequest();
+}
+
+CURLcode HttpClient::Transfer() {
+  if (ConnectionManager.fixture.mode == kHttpFixtureReplay)
+    return ConnectionManager.fixture.Replay(*this);
+
+  return base::http::Client::Transfer();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static void SaveLibraryEntryImage(int anime_id, const std::string& data) {
+  SaveToFile(data, anime::GetImagePath(anime_id));
+  if (ImageDatabase.Load(anime_id, true, false))
+    ui::OnLibraryEntryImageChange(anime_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+HttpManager::HostHealth::HostHealth()
+    : state(kBreakerClosed),
+      failures(0),
+      probing(false),
+      retry_time(0),
+      trips(0) {
+}
+
+HttpManager::HostQueue::HostQueue()
+    : connections(0) {
+  for (int i = 0; i < kHttpPriorityCount; i++)
+    scheduled[i] = false;
+}
+
+HttpManager::PooledClient::PooledClient(const HttpRequest& request)
+    : client(request),
+      host(ToLower_Copy(request.url.host)),
+      idle_time(GetTickCount()) {
+}
+
+HttpManager::QueueStats::QueueStats()
+    : requests(0),
+      total_wait(0),
+      max_wait(0) {
+}
+
+HttpManager::HttpManager()
+    : cancelled_requests(0),
+      coalesced_requests(0),
+      created_clients(0),
+      evicted_clients(0),
+      fast_failed_requests(0),
+      reused_clients(0),
+      connections_(0) {
+  for (int i = 0; i < kHttpPriorityCount; i++)
+    priority_credits_[i] = kPriorityWeights[i];
+}
+
 void HttpManager::CancelRequest(base::uid_t uid) {
+  if (DetachFromInFlight(uid))
+    return;
+
+  // Requests that are still in the queue are cancelled right away, while a
+  // transfer reports back once it has been aborted
+  QueuedRequest queued;
+  if (RemoveFromQueue(uid, queued)) {
+    ReportCancel(queued.request, queued.mode);
+    ProcessQueue();
+    return;
+  }
+
   auto client = FindClient(uid);
 
   if (client && client->busy())
@@ -135,13 +297,63 @@ void HttpManager::CancelRequest(base::uid_t uid) {
 }
 
 void HttpManager::MakeRequest(HttpRequest& request, HttpClientMode mode) {
+  // Service requests are reported by the service manager, which knows whether
+  // they were made in the background
+  switch (mode) {
+    case kHttpSilent:
+    case kHttpServiceAuthenticateUser:
+    case kHttpServiceGetMetadataById:
+    case kHttpServiceGetMetadataByIdV2:
+    case kHttpServiceSearchTitle:
+    case kHttpServiceAddLibraryEntry:
+    case kHttpServiceDeleteLibraryEntry:
+    case kHttpServiceGetLibraryEntries:
+    case kHttpServiceUpdateLibraryEntry:
+    case kHttpFeedCheckAuto:
+      break;
+    default:
+      MetadataPrefetcher.OnUserRequest();
+      break;
+  }
+
+  if (IsCoalescable(mode) && AttachToInFlight(request, mode)) {
+    ReportSend(request, mode);
+    return;
+  }
+
+  if (IsCacheable(mode))
+    cache.AddValidators(request);
+
   AddToQueue(request, mode);
   ProcessQueue();
 }
 
-void HttpManager::HandleError(HttpResponse& response, const string_t& error) {
+void HttpManager::HandleCancel(HttpResponse& response) {
   HttpClient& client = *FindClient(response.uid);
 
+  // Cancelled transfers cannot be a probe for their host
+  ReleaseProbe(client.request_.url.host);
+
+  ReportCancel(client.request_, client.mode());
+
+  ReleaseClient(client);
+  FreeConnection(client.request_.url.host);
+  ProcessQueue();
+}
+
+void HttpManager::HandleError(HttpResponse& response, const string_t& error,
+                              bool host_failure) {
+  HttpClient& client = *FindClient(response.uid);
+
+  if (host_failure) {
+    ReportFailure(client.request_.url.host);
+  } else {
+    ReleaseProbe(client.request_.url.host);
+  }
+
+  std::vector<HttpRequest> followers;
+  ReleaseInFlight(response.uid, followers);
+
   switch (client.mode()) {
     case kHttpServiceAuthenticateUser:
     case kHttpServiceGetMetadataById:
@@ -152,9 +364,16 @@ void HttpManager::HandleError(HttpResponse& response, const string_t& error) {
     case kHttpServiceGetLibraryEntries:
     case kHttpServiceUpdateLibraryEntry:
       ServiceManager.HandleHttpError(client.response_, error);
+      foreach_(it, followers) {
+        HttpResponse follower_response = client.response_;
+        follower_response.uid = it->uid;
+        follower_response.parameter = it->parameter;
+        ServiceManager.HandleHttpError(follower_response, error);
+      }
       break;
   }
 
+  ReleaseClient(client);
   FreeConnection(client.request_.url.host);
   ProcessQueue();
 }
@@ -168,6 +387,45 @@ void HttpManager::HandleRedirect(const std::wstring& current_host,
 void HttpManager::HandleResponse(HttpResponse& response) {
   HttpClient& client = *FindClient(response.uid);
 
+  if (response.code >= 500 || response.code == 429) {
+    ReportFailure(client.request_.url.host);
+  } else {
+    ReportSuccess(client.request_.url.host);
+  }
+
+  if (IsCacheable(client.mode())) {
+    if (response.code == 304) {
+      // Serve the body from the cache, as if it was just downloaded
+      if (!cache.Restore(client.request_, response.body)) {
+        HandleError(response, L"Cached response is no longer available");
+        return;
+      }
+      response.code = 200;
+    } else if (response.code == 200) {
+      // Images are saved to their own folder anyway, so the cache only keeps
+      // their validators
+      if (client.mode() == kHttpGetLibraryEntryImage) {
+        cache.Store(client.request_, response, response.body,
+                    anime::GetImagePath(static_cast<int>(response.parameter)));
+      } else {
+        cache.Store(client.request_, response, response.body);
+      }
+    } else {
+      cache.Remove(client.request_);
+    }
+  }
+
+  // Requests that were waiting for this transfer receive a copy of the
+  // response, which is made before the original is handled
+  std::vector<HttpRequest> followers;
+  ReleaseInFlight(response.uid, followers);
+  std::vector<HttpResponse> follower_responses;
+  foreach_(it, followers) {
+    follower_responses.push_back(response);
+    follower_responses.back().uid = it->uid;
+    follower_responses.back().parameter = it->parameter;
+  }
+
   switch (client.mode()) {
     case kHttpServiceAuthenticateUser:
     case kHttpServiceGetMetadataById:
@@ -180,30 +438,33 @@ void HttpManager::HandleResponse(HttpResponse& response) {
       ServiceManager.HandleHttpResponse(response);
       break;
 
-    case kHttpGetLibraryEntryImage: {
-      int anime_id = static_cast<int>(response.parameter);
-      SaveToFile(client.write_buffer_, anime::GetImagePath(anime_id));
-      if (ImageDatabase.Load(anime_id, true, false))
-        ui::OnLibraryEntryImageChange(anime_id);
+    case kHttpGetLibraryEntryImage:
+      SaveLibraryEntryImage(static_cast<int>(response.parameter),
+                            response.body);
       break;
-    }
 
     case kHttpFeedCheck:
     case kHttpFeedCheckAuto: {
       Feed* feed = reinterpret_cast<Feed*>(response.parameter);
       if (feed) {
         bool automatic = client.mode() == kHttpFeedCheckAuto;
-        Aggregator.HandleFeedCheck(*feed, client.write_buffer_, automatic);
+        Aggregator.HandleFeedCheck(*feed, response.body, automatic);
       }
       break;
     }
     case kHttpFeedDownload:
     case kHttpFeedDownloadAll: {
-      if (Aggregator.ValidateFeedDownload(client.request(), response)) {
+      // Files have been validated before they were committed, while anything
+      // else (e.g. an error page) is still kept in memory
+      if (!response.file.empty())
+        LOG(LevelDebug, L"Downloaded: " + response.file +
+                        L" (CRC " + response.file_checksum + L")");
+      if (!response.file.empty() ||
+          Aggregator.ValidateFeedDownload(client.request(), response)) {
         auto feed = reinterpret_cast<Feed*>(response.parameter);
         if (feed) {
           bool download_all = client.mode() == kHttpFeedDownloadAll;
-          Aggregator.HandleFeedDownload(*feed, client.write_buffer_, download_all);
+          Aggregator.HandleFeedDownload(*feed, download_all);
         }
       }
       break;
@@ -216,18 +477,32 @@ void HttpManager::HandleResponse(HttpResponse& response) {
       break;
 
     case kHttpTaigaUpdateCheck:
-      if (Taiga.Updater.ParseData(response.body))
+      if (Taiga.Updater.ParseData(response.GetWideBody()))
         if (Taiga.Updater.IsDownloadAllowed())
           break;
       ui::OnUpdateFinished();
       break;
     case kHttpTaigaUpdateDownload:
-      SaveToFile(client.write_buffer_, Taiga.Updater.GetDownloadPath());
       Taiga.Updater.RunInstaller();
       ui::OnUpdateFinished();
       break;
   }
 
+  foreach_(it, follower_responses) {
+    switch (client.mode()) {
+      case kHttpServiceGetMetadataById:
+      case kHttpServiceGetMetadataByIdV2:
+        ServiceManager.HandleHttpResponse(*it);
+        break;
+      case kHttpGetLibraryEntryImage:
+        if (it->parameter != response.parameter)
+          SaveLibraryEntryImage(static_cast<int>(it->parameter),
+                                response.body);
+        break;
+    }
+  }
+
+  ReleaseClient(client);
   FreeConnection(client.request_.url.host);
   ProcessQueue();
 }
@@ -235,55 +510,477 @@ void HttpManager::HandleResponse(HttpResponse& response) {
 ////////////////////////////////////////////////////////////////////////////////
 
 void HttpManager::FreeMemory() {
-  for (auto it = clients_.cbegin(); it != clients_.cend(); ) {
-    if (!it->busy()) {
-      clients_.erase(it++);
-    } else {
-      ++it;
-    }
-  }
+  cache.Save();
+
+  EvictClients(true);
+
+  // Torrent files are downloaded into a folder of their feed, and updates
+  // next to the executable
+  base::http::Client::DeleteExpiredPartialFiles(
+      taiga::GetPath(taiga::kPathFeed), true);
+  base::http::Client::DeleteExpiredPartialFiles(
+      GetPathOnly(Taiga.Updater.GetDownloadPath()));
 }
 
 void HttpManager::Shutdown() {
+  // Transfers may still call back into the manager until the transport threads
+  // are stopped, so this is done before taking the lock
+  base::http::Client::ShutdownTransport();
+
+  cache.Save();
+
+  win::Lock lock(critical_section_);
+  clients_by_host_.clear();
+  clients_by_uid_.clear();
   clients_.clear();
+  in_flight_.clear();
+  in_flight_keys_.clear();
+  for (int i = 0; i < kHttpPriorityCount; i++)
+    ready_hosts_[i].clear();
+  hosts_.clear();
+}
+
+BreakerState HttpManager::GetBreakerState(const std::wstring& host) {
+  win::Lock lock(critical_section_);
+
+  auto it = host_health_.find(host);
+  if (it == host_health_.end())
+    return kBreakerClosed;
+
+  return it->second.state;
+}
+
+size_t HttpManager::GetInFlightCount() {
+  win::Lock lock(critical_section_);
+
+  return in_flight_.size();
+}
+
+HttpManager::QueueStats HttpManager::GetQueueStats(HttpPriority priority) {
+  win::Lock lock(critical_section_);
+
+  return queue_stats_[priority];
+}
+
+size_t HttpManager::GetQueueSize() {
+  win::Lock lock(critical_section_);
+
+  size_t size = 0;
+  foreach_c_(it, hosts_)
+    for (int i = 0; i < kHttpPriorityCount; i++)
+      size += it->second.requests[i].size();
+
+  return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool HttpManager::AllowRequest(const std::wstring& host) {
+  win::Lock lock(critical_section_);
+
+  auto it = host_health_.find(host);
+  if (it == host_health_.end())
+    return true;
+
+  HostHealth& health = it->second;
+
+  switch (health.state) {
+    case kBreakerClosed:
+      return true;
+    case kBreakerOpen:
+      if (time(nullptr) < health.retry_time)
+        return false;
+      // Let a single request through to see if the host has recovered
+      health.state = kBreakerHalfOpen;
+      health.probing = true;
+      LOG(LevelDebug, L"Probing host: " + host);
+      return true;
+    case kBreakerHalfOpen:
+      if (health.probing)
+        return false;
+      health.probing = true;
+      return true;
+  }
+
+  return true;
+}
+
+void HttpManager::FailRequest(const HttpRequest& request, HttpClientMode mode,
+                              const std::wstring& error) {
+  LOG(LevelWarning, error + L"\nID: " + request.uid);
+
+  fast_failed_requests++;
+
+  ui::OnHttpError(mode, error);
+
+  std::vector<HttpRequest> requests;
+  ReleaseInFlight(request.uid, requests);
+  requests.insert(requests.begin(), request);
+
+  if (IsServiceRequest(mode)) {
+    foreach_(it, requests) {
+      HttpResponse response;
+      response.uid = it->uid;
+      response.parameter = it->parameter;
+      ServiceManager.HandleHttpError(response, error);
+    }
+  }
+}
+
+void HttpManager::ReleaseProbe(const std::wstring& host) {
+  win::Lock lock(critical_section_);
+
+  // Another request may be sent as a probe, if this one was cancelled
+  auto it = host_health_.find(host);
+  if (it != host_health_.end())
+    it->second.probing = false;
+}
+
+void HttpManager::ReportFailure(const std::wstring& host) {
+  win::Lock lock(critical_section_);
+
+  HostHealth& health = host_health_[host];
+
+  health.failures++;
+  health.probing = false;
+
+  if (health.state == kBreakerClosed && health.failures < kBreakerThreshold)
+    return;
+
+  // A failed probe opens the breaker again, for longer
+  health.trips++;
+  time_t delay = kBreakerBaseDelay << min(health.trips - 1, 5U);
+  delay = min(delay, kBreakerMaxDelay);
+  delay += rand() % (delay / 5 + 1);
+
+  health.state = kBreakerOpen;
+  health.retry_time = time(nullptr) + delay;
+
+  LOG(LevelWarning, L"Host is unavailable for " +
+                    ToWstr(static_cast<int>(delay)) + L" seconds: " + host);
+}
+
+void HttpManager::ReportSuccess(const std::wstring& host) {
+  win::Lock lock(critical_section_);
+
+  auto it = host_health_.find(host);
+  if (it == host_health_.end())
+    return;
+
+  if (it->second.state != kBreakerClosed)
+    LOG(LevelDebug, L"Host is available again: " + host);
+
+  host_health_.erase(it);
+}
+
+bool HttpManager::AttachToInFlight(const HttpRequest& request,
+                                   HttpClientMode mode) {
+  win::Lock lock(critical_section_);
+
+  std::wstring key = GetRequestKey(request);
+
+  auto it = in_flight_keys_.find(key);
+  if (it != in_flight_keys_.end()) {
+    InFlightRequest& in_flight = in_flight_[it->second];
+    if (in_flight.mode != mode)
+      return false;
+    in_flight.followers.push_back(request);
+    coalesced_requests++;
+    LOG(LevelDebug, L"ID: " + request.uid +
+                    L"\nAttached to in-flight request: " + it->second);
+    return true;
+  }
+
+  InFlightRequest& in_flight = in_flight_[request.uid];
+  in_flight.key = key;
+  in_flight.mode = mode;
+  in_flight_keys_[key] = request.uid;
+
+  return false;
+}
+
+bool HttpManager::DetachFromInFlight(base::uid_t uid) {
+  win::Lock lock(critical_section_);
+
+  auto leader = in_flight_.find(uid);
+  if (leader != in_flight_.end()) {
+    // Other requests are still waiting for this transfer
+    if (!leader->second.followers.empty()) {
+      LOG(LevelDebug, L"Transfer is shared, not cancelling: " + uid);
+      return true;
+    }
+    // Otherwise it is released here, rather than when the transfer reports
+    // back, which it may never do if it has already finished or not started
+    in_flight_keys_.erase(leader->second.key);
+    in_flight_.erase(leader);
+    return false;
+  }
+
+  foreach_(it, in_flight_) {
+    auto& followers = it->second.followers;
+    for (auto follower = followers.begin(); follower != followers.end(); ++follower) {
+      if (follower->uid == uid) {
+        followers.erase(follower);
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void HttpManager::ReleaseInFlight(base::uid_t uid,
+                                  std::vector<HttpRequest>& followers) {
+  win::Lock lock(critical_section_);
+
+  auto it = in_flight_.find(uid);
+  if (it == in_flight_.end())
+    return;
+
+  followers.swap(it->second.followers);
+  in_flight_keys_.erase(it->second.key);
+  in_flight_.erase(it);
+}
+
+std::wstring HttpManager::GetRequestKey(const HttpRequest& request) const {
+  return request.method + L" " + request.url.Build() + L" " +
+         CalculateCrcFromString(request.body);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+std::wstring HttpManager::GetDownloadPath(const HttpRequest& request,
+                                          HttpClientMode mode) const {
+  // Large files are written to disk as they are received, instead of being
+  // kept in memory until the transfer is complete
+  switch (mode) {
+    case kHttpFeedDownload:
+    case kHttpFeedDownloadAll: {
+      auto feed = reinterpret_cast<Feed*>(request.parameter);
+      if (feed)
+        return feed->GetDownloadPath();
+      break;
+    }
+    case kHttpTaigaUpdateDownload:
+      return Taiga.Updater.GetDownloadPath();
+  }
+
+  return std::wstring();
+}
+
+bool HttpManager::IsCacheable(HttpClientMode mode) const {
+  switch (mode) {
+    case kHttpServiceGetMetadataById:
+    case kHttpServiceGetMetadataByIdV2:
+    case kHttpGetLibraryEntryImage:
+    case kHttpFeedCheck:
+    case kHttpFeedCheckAuto:
+      return true;
+  }
+
+  return false;
+}
+
+bool HttpManager::IsCoalescable(HttpClientMode mode) const {
+  switch (mode) {
+    case kHttpServiceGetMetadataById:
+    case kHttpServiceGetMetadataByIdV2:
+    case kHttpGetLibraryEntryImage:
+      return true;
+  }
+
+  return false;
+}
+
+bool HttpManager::IsServiceRequest(HttpClientMode mode) const {
+  switch (mode) {
+    case kHttpServiceAuthenticateUser:
+    case kHttpServiceGetMetadataById:
+    case kHttpServiceGetMetadataByIdV2:
+    case kHttpServiceSearchTitle:
+    case kHttpServiceAddLibraryEntry:
+    case kHttpServiceDeleteLibraryEntry:
+    case kHttpServiceGetLibraryEntries:
+    case kHttpServiceUpdateLibraryEntry:
+      return true;
+  }
+
+  return false;
+}
+
 HttpClient* HttpManager::FindClient(base::uid_t uid) {
-  foreach_(it, clients_)
-    if (it->request().uid == uid)
-      return &(*it);
+  win::Lock lock(critical_section_);
+
+  auto it = clients_by_uid_.find(uid);
+  if (it == clients_by_uid_.end())
+    return nullptr;
 
-  return nullptr;
+  return &it->second->client;
 }
 
 HttpClient& HttpManager::GetClient(const HttpRequest& request) {
-  HttpClient* client = nullptr;
-
-  foreach_(it, clients_) {
-    if (it->allow_reuse() && !it->busy()) {
-      if (IsEqual(it->request().url.host, request.url.host)) {
-        LOG(LevelDebug, L"Reusing client with the ID: " + it->request().uid +
-                        L"\nClient's new ID: " + request.uid);
-        client = &(*it);
-        // Proxy settings might have changed since then
-        client->set_proxy(Settings[kApp_Connection_ProxyHost],
-                          Settings[kApp_Connection_ProxyUsername],
-                          Settings[kApp_Connection_ProxyPassword]);
-        break;
-      }
+  win::Lock lock(critical_section_);
+
+  EvictClients(false);
+
+  PooledClient* pooled = nullptr;
+  std::wstring host = ToLower_Copy(request.url.host);
+
+  auto range = clients_by_host_.equal_range(host);
+  for (auto it = range.first; it != range.second; ++it) {
+    HttpClient& client = it->second->client;
+    if (client.allow_reuse() && !client.busy()) {
+      LOG(LevelDebug, L"Reusing client with the ID: " + client.request().uid +
+                      L"\nClient's new ID: " + request.uid);
+      pooled = it->second;
+      clients_by_uid_.erase(client.request().uid);
+      // Proxy settings might have changed since then
+      client.set_proxy(Settings[kApp_Connection_ProxyHost],
+                       Settings[kApp_Connection_ProxyUsername],
+                       Settings[kApp_Connection_ProxyPassword]);
+      reused_clients++;
+      break;
     }
   }
 
-  if (!client) {
-    clients_.push_back(HttpClient(request));
-    client = &clients_.back();
+  if (!pooled) {
+    // Make room for the new client, if there are idle clients to spare
+    while (clients_.size() >= kMaxPooledClients) {
+      auto oldest = clients_.end();
+      for (auto it = clients_.begin(); it != clients_.end(); ++it)
+        if (!it->client.busy() &&
+            (oldest == clients_.end() || it->idle_time < oldest->idle_time))
+          oldest = it;
+      if (oldest == clients_.end())
+        break;
+      RemoveClient(oldest);
+    }
+
+    clients_.push_back(PooledClient(request));
+    pooled = &clients_.back();
+    clients_by_host_.insert(std::make_pair(host, pooled));
+    created_clients++;
     LOG(LevelDebug, L"Created a new client. Total number of clients is now " +
                     ToWstr(static_cast<int>(clients_.size())));
   }
 
-  return *client;
+  pooled->idle_time = GetTickCount();
+  clients_by_uid_[request.uid] = pooled;
+
+  return pooled->client;
+}
+
+bool HttpManager::SendToClient(const HttpRequest& request,
+                               HttpClientMode mode) {
+  HttpClient& client = GetClient(request);
+  client.set_mode(mode);
+  client.set_download_path(GetDownloadPath(request, mode));
+
+  if (client.MakeRequest(request))
+    return true;
+
+  // The client was cleaned up without calling back, and is free to be reused
+  win::Lock lock(critical_section_);
+  clients_by_uid_.erase(request.uid);
+  return false;
+}
+
+void HttpManager::ReleaseClient(HttpClient& client) {
+  win::Lock lock(critical_section_);
+
+  auto it = clients_by_uid_.find(client.request().uid);
+  if (it != clients_by_uid_.end())
+    it->second->idle_time = GetTickCount();
+}
+
+void HttpManager::EvictClients(bool all) {
+  win::Lock lock(critical_section_);
+
+  unsigned long tick_count = GetTickCount();
+
+  for (auto it = clients_.begin(); it != clients_.end(); ) {
+    if (!it->client.busy() &&
+        (all || !it->client.allow_reuse() ||
+         tick_count - it->idle_time >= kClientIdleTimeout)) {
+      RemoveClient(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void HttpManager::RemoveClient(client_iterator_t it) {
+  auto range = clients_by_host_.equal_range(it->host);
+  for (auto host = range.first; host != range.second; ++host) {
+    if (host->second == &(*it)) {
+      clients_by_host_.erase(host);
+      break;
+    }
+  }
+
+  auto uid = clients_by_uid_.find(it->client.request().uid);
+  if (uid != clients_by_uid_.end() && uid->second == &(*it))
+    clients_by_uid_.erase(uid);
+
+  clients_.erase(it);
+  evicted_clients++;
+}
+
+HttpPriority HttpManager::GetPriority(HttpClientMode mode) const {
+  switch (mode) {
+    case kHttpServiceAuthenticateUser:
+    case kHttpServiceSearchTitle:
+    case kHttpServiceAddLibraryEntry:
+    case kHttpServiceDeleteLibraryEntry:
+    case kHttpServiceGetLibraryEntries:
+    case kHttpServiceUpdateLibraryEntry:
+    case kHttpTwitterRequest:
+    case kHttpTwitterAuth:
+    case kHttpTwitterPost:
+      return kHttpPriorityInteractive;
+    case kHttpServiceGetMetadataById:
+    case kHttpServiceGetMetadataByIdV2:
+      return kHttpPriorityMetadata;
+    case kHttpGetLibraryEntryImage:
+      return kHttpPriorityImage;
+    case kHttpSilent:
+    case kHttpFeedCheck:
+    case kHttpFeedCheckAuto:
+    case kHttpFeedDownload:
+    case kHttpFeedDownloadAll:
+      return kHttpPriorityFeed;
+    case kHttpTaigaUpdateCheck:
+    case kHttpTaigaUpdateDownload:
+      return kHttpPriorityUpdate;
+  }
+
+  return kHttpPriorityFeed;
+}
+
+int HttpManager::SelectPriority() {
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < kHttpPriorityCount; i++)
+      if (priority_credits_[i] > 0 && !ready_hosts_[i].empty())
+        return i;
+
+    // Every class with waiting requests has used up its share for this round
+    for (int i = 0; i < kHttpPriorityCount; i++)
+      priority_credits_[i] = kPriorityWeights[i];
+  }
+
+  return kHttpPriorityCount;
+}
+
+void HttpManager::ScheduleHost(HostQueue& host) {
+  if (host.connections >= kMaxSimultaneousConnectionsPerHostname)
+    return;
+
+  for (int i = 0; i < kHttpPriorityCount; i++) {
+    if (!host.scheduled[i] && !host.requests[i].empty()) {
+      host.scheduled[i] = true;
+      ready_hosts_[i].push_back(&host);
+    }
+  }
 }
 
 void HttpManager::AddToQueue(HttpRequest& request, HttpClientMode mode) {
@@ -292,59 +989,185 @@ void HttpManager::AddToQueue(HttpRequest& request, HttpClientMode mode) {
 
   LOG(LevelDebug, L"ID: " + request.uid);
 
-  requests_.push_back(std::make_pair(request, mode));
+  HostQueue& host = hosts_[request.url.host];
+
+  QueuedRequest queued;
+  queued.request = request;
+  queued.mode = mode;
+  queued.queue_time = GetTickCount();
+  host.requests[GetPriority(mode)].push_back(queued);
+
+  ScheduleHost(host);
 #else
-  HttpClient& client = GetClient(request);
-  client.set_mode(mode);
-  client.MakeRequest(request);
+  if (!AllowRequest(request.url.host)) {
+    FailRequest(request, mode,
+                L"Host is temporarily unavailable (" + request.url.host + L")");
+    return;
+  }
+
+  ReportSend(request, mode);
+
+  if (!SendToClient(request, mode)) {
+    ReleaseProbe(request.url.host);
+    FailRequest(request, mode,
+                L"Could not send request (" + request.url.host + L")");
+  }
 #endif
 }
 
 void HttpManager::ProcessQueue() {
 #ifdef TAIGA_HTTP_MULTITHREADED
-  win::Lock lock(critical_section_);
+  std::vector<QueuedRequest> cancelled_requests;
+  std::vector<QueuedRequest> failed_requests;
+  std::vector<QueuedRequest> rejected_requests;
+  std::vector<QueuedRequest> sent_requests;
+
+  {
+    win::Lock lock(critical_section_);
+
+    while (connections_ < kMaxSimultaneousConnections) {
+      int priority = SelectPriority();
+      if (priority == kHttpPriorityCount)
+        break;
+
+      HostQueue& host = *ready_hosts_[priority].front();
+      ready_hosts_[priority].pop_front();
+      host.scheduled[priority] = false;
+
+      // Hosts that have reached their limit are taken out of the rings, and
+      // scheduled again once a connection is freed
+      if (host.connections >= kMaxSimultaneousConnectionsPerHostname)
+        continue;
+
+      QueuedRequest queued = host.requests[priority].front();
+      host.requests[priority].pop_front();
 
-  unsigned int connections = 0;
-  foreach_(it, connections_)
-    connections += it->second;
+      const HttpRequest& request = queued.request;
 
-  for (size_t i = 0; i < requests_.size(); i++) {
-    if (connections == kMaxSimultaneousConnections) {
-      LOG(LevelDebug, L"Reached max connections");
-      return;
+      if (request.cancellation_token.cancelled()) {
+        cancelled_requests.push_back(queued);
+        ScheduleHost(host);
+        continue;
+      }
+
+      priority_credits_[priority]--;
+
+      if (!AllowRequest(request.url.host)) {
+        rejected_requests.push_back(queued);
+      } else {
+        unsigned long wait = GetTickCount() - queued.queue_time;
+        QueueStats& stats = queue_stats_[priority];
+        stats.requests++;
+        stats.total_wait += wait;
+        stats.max_wait = max(stats.max_wait, wait);
+
+        // The transfer cannot finish before the lock is released, so the
+        // connection is only taken once the client has accepted the request
+        if (SendToClient(request, queued.mode)) {
+          connections_++;
+          host.connections++;
+          LOG(LevelDebug, L"Connections for hostname is now " +
+                          ToWstr(static_cast<int>(host.connections)) +
+                          L": " + request.url.host +
+                          L"\nWaited in queue for " +
+                          ToWstr(static_cast<int>(wait)) + L" ms");
+          sent_requests.push_back(queued);
+        } else {
+          ReleaseProbe(request.url.host);
+          failed_requests.push_back(queued);
+        }
+      }
+
+      // Take turns with the other hosts in this class
+      ScheduleHost(host);
     }
+  }
+
+  foreach_(it, sent_requests)
+    ReportSend(it->request, it->mode);
+
+  // Requests to an unavailable host fail without taking up a connection
+  foreach_(it, rejected_requests)
+    FailRequest(it->request, it->mode,
+                L"Host is temporarily unavailable (" +
+                it->request.url.host + L")");
 
-    const HttpRequest& request = requests_.at(i).first;
-    HttpClientMode mode = requests_.at(i).second;
+  foreach_(it, failed_requests)
+    FailRequest(it->request, it->mode,
+                L"Could not send request (" + it->request.url.host + L")");
 
-    if (connections_[request.url.host] == kMaxSimultaneousConnectionsPerHostname) {
-      LOG(LevelDebug, L"Reached max connections for hostname: " + request.url.host);
-      continue;
+  foreach_(it, cancelled_requests)
+    ReportCancel(it->request, it->mode);
+  // Requests that were waiting for a cancelled one may have been queued again
+  if (!cancelled_requests.empty())
+    ProcessQueue();
+#endif
+}
+
+bool HttpManager::RemoveFromQueue(base::uid_t uid, QueuedRequest& queued) {
+  win::Lock lock(critical_section_);
+
+  foreach_(host, hosts_) {
+    for (int i = 0; i < kHttpPriorityCount; i++) {
+      auto& requests = host->second.requests[i];
+      for (auto it = requests.begin(); it != requests.end(); ++it) {
+        if (it->request.uid == uid) {
+          queued = *it;
+          requests.erase(it);
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+void HttpManager::ReportCancel(const HttpRequest& request,
+                               HttpClientMode mode) {
+  LOG(LevelDebug, L"Request was cancelled. ID: " + request.uid);
+
+  cancelled_requests++;
+
+  // Requests that were waiting for this transfer were not cancelled
+  // themselves, so they are made again
+  std::vector<HttpRequest> followers;
+  ReleaseInFlight(request.uid, followers);
+  foreach_(it, followers) {
+    if (AttachToInFlight(*it, mode)) {
+      ReportSend(*it, mode);
     } else {
-      connections++;
-      connections_[request.url.host]++;
-      LOG(LevelDebug, L"Connections for hostname is now " +
-                      ToWstr(static_cast<int>(connections_[request.url.host])) +
-                      L": " + request.url.host);
-
-      HttpClient& client = GetClient(request);
-      client.set_mode(mode);
-      client.MakeRequest(request);
-
-      requests_.erase(requests_.begin() + i);
-      i--;
+      AddToQueue(*it, mode);
     }
   }
-#endif
+
+  // Cancelled requests are reported apart from failed ones, so that their
+  // responses are neither handled nor shown as errors
+  if (IsServiceRequest(mode)) {
+    HttpResponse response;
+    response.uid = request.uid;
+    response.parameter = request.parameter;
+    ServiceManager.HandleHttpCancel(response);
+  }
+}
+
+void HttpManager::ReportSend(const HttpRequest& request, HttpClientMode mode) {
+  // The service manager starts timing the request from here on, rather than
+  // from when it was queued
+  if (IsServiceRequest(mode))
+    ServiceManager.HandleHttpSend(request.uid);
 }
 
 void HttpManager::AddConnection(const string_t& hostname) {
 #ifdef TAIGA_HTTP_MULTITHREADED
   win::Lock lock(critical_section_);
 
-  connections_[hostname]++;
+  HostQueue& host = hosts_[hostname];
+
+  connections_++;
+  host.connections++;
   LOG(LevelDebug, L"Connections for hostname is now " +
-                  ToWstr(static_cast<int>(connections_[hostname])) + 
+                  ToWstr(static_cast<int>(host.connections)) + 
                   L": " + hostname);
 #endif
 }
@@ -353,11 +1176,15 @@ void HttpManager::FreeConnection(const string_t& hostname) {
 #ifdef TAIGA_HTTP_MULTITHREADED
   win::Lock lock(critical_section_);
 
-  if (connections_[hostname] > 0) {
-    connections_[hostname]--;
+  HostQueue& host = hosts_[hostname];
+
+  if (host.connections > 0) {
+    connections_--;
+    host.connections--;
     LOG(LevelDebug, L"Connections for hostname is now " +
-                    ToWstr(static_cast<int>(connections_[hostname])) +
+                    ToWstr(static_cast<int>(host.connections)) +
                     L": " + hostname);
+    ScheduleHost(host);
   } else {
     LOG(LevelError, L"Connections for hostname was already zero: " + hostname);
   }
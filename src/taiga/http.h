@@ -19,11 +19,17 @@
 #ifndef TAIGA_TAIGA_HTTP_H
 #define TAIGA_TAIGA_HTTP_H
 
+#include <ctime>
+#include <deque>
 #include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 #include "base/http.h"
 #include "base/types.h"
+#include "taiga/http_cache.h"
+#include "taiga/http_fixture.h"
 #include "win/win_thread.h"
 
 namespace taiga {
@@ -55,8 +61,30 @@ enum HttpClientMode {
   kHttpTaigaUpdateDownload
 };
 
+// Queued requests are dispatched by priority class, so that background traffic
+// (e.g. images) cannot hold up the user's own requests
+enum HttpPriority {
+  kHttpPriorityInteractive,
+  kHttpPriorityMetadata,
+  kHttpPriorityImage,
+  kHttpPriorityFeed,
+  kHttpPriorityUpdate,
+  kHttpPriorityCount
+};
+
+// Each host has a circuit breaker, which opens after consecutive failures.
+// Requests to the host fail immediately while it is open. Once the backoff
+// delay has passed, a single request is let through as a probe, and the
+// breaker closes again if it succeeds.
+enum BreakerState {
+  kBreakerClosed,
+  kBreakerOpen,
+  kBreakerHalfOpen
+};
+
 class HttpClient : public base::http::Client {
 public:
+  friend class HttpFixture;
   friend class HttpManager;
 
   HttpClient(const HttpRequest& request);
@@ -66,11 +94,16 @@ public:
   void set_mode(HttpClientMode mode);
 
 protected:
+  void OnCancel();
   void OnError(CURLcode error_code);
   bool OnHeadersAvailable();
   bool OnProgress();
   void OnReadComplete();
   bool OnRedirect(const std::wstring& address);
+  bool OnValidateDownload(const std::string& head);
+
+  bool SendRequest();
+  CURLcode Transfer();
 
 private:
   HttpClientMode mode_;
@@ -78,29 +111,155 @@ private:
 
 class HttpManager {
 public:
+  HttpManager();
+
+  // Time that requests of a priority class spent in the queue, in milliseconds
+  class QueueStats {
+  public:
+    QueueStats();
+
+    unsigned int requests;
+    unsigned long total_wait;
+    unsigned long max_wait;
+  };
+
   void CancelRequest(base::uid_t uid);
   void MakeRequest(HttpRequest& request, HttpClientMode mode);
 
-  void HandleError(HttpResponse& response, const string_t& error);
+  void HandleCancel(HttpResponse& response);
+  void HandleError(HttpResponse& response, const string_t& error,
+                   bool host_failure = false);
   void HandleRedirect(const std::wstring& current_host, const std::wstring& next_host);
   void HandleResponse(HttpResponse& response);
 
   void FreeMemory();
   void Shutdown();
 
+  BreakerState GetBreakerState(const std::wstring& host);
+  size_t GetInFlightCount();
+  QueueStats GetQueueStats(HttpPriority priority);
+  size_t GetQueueSize();
+
+  HttpCache cache;
+  HttpFixture fixture;
+
+  // Number of requests that were cancelled, either before or during their
+  // transfer
+  unsigned int cancelled_requests;
+  // Number of requests that were attached to an identical in-flight transfer,
+  // instead of being made separately
+  unsigned int coalesced_requests;
+  // Number of requests that were given a new client, or a pooled client (and
+  // its open connections) of the same host, and number of pooled clients that
+  // were removed for being idle or over the limit
+  unsigned int created_clients;
+  unsigned int reused_clients;
+  unsigned int evicted_clients;
+  // Number of requests that failed immediately, because their host was
+  // unavailable
+  unsigned int fast_failed_requests;
+
 private:
+  class HostHealth {
+  public:
+    HostHealth();
+
+    BreakerState state;
+    unsigned int failures;
+    bool probing;
+    time_t retry_time;
+    unsigned int trips;
+  };
+
+  bool AllowRequest(const std::wstring& host);
+  void FailRequest(const HttpRequest& request, HttpClientMode mode,
+                   const std::wstring& error);
+  void ReleaseProbe(const std::wstring& host);
+  void ReportFailure(const std::wstring& host);
+  void ReportSuccess(const std::wstring& host);
+
+  // Identical requests that are made while a transfer is in flight wait for
+  // its response, instead of having their own transfer
+  class InFlightRequest {
+  public:
+    std::wstring key;
+    HttpClientMode mode;
+    std::vector<HttpRequest> followers;
+  };
+
+  bool AttachToInFlight(const HttpRequest& request, HttpClientMode mode);
+  bool DetachFromInFlight(base::uid_t uid);
+  void ReleaseInFlight(base::uid_t uid, std::vector<HttpRequest>& followers);
+  std::wstring GetRequestKey(const HttpRequest& request) const;
+
+  std::wstring GetDownloadPath(const HttpRequest& request,
+                               HttpClientMode mode) const;
+  bool IsCacheable(HttpClientMode mode) const;
+  bool IsCoalescable(HttpClientMode mode) const;
+  bool IsServiceRequest(HttpClientMode mode) const;
+
+  // Clients are kept after their transfer, so that the next request to the
+  // same host can use their open connections. They are indexed by the UID of
+  // their current request and by host, and removed once they have been idle
+  // for too long.
+  class PooledClient {
+  public:
+    PooledClient(const HttpRequest& request);
+
+    HttpClient client;
+    std::wstring host;
+    unsigned long idle_time;
+  };
+  typedef std::list<PooledClient>::iterator client_iterator_t;
+
   HttpClient* FindClient(base::uid_t uid);
   HttpClient& GetClient(const HttpRequest& request);
+  bool SendToClient(const HttpRequest& request, HttpClientMode mode);
+  void ReleaseClient(HttpClient& client);
+  void EvictClients(bool all);
+  void RemoveClient(client_iterator_t it);
+
+  // Each host has a FIFO queue per priority class. Hosts that have requests
+  // of a class, and free connections, take turns in that class' ring.
+  class QueuedRequest {
+  public:
+    HttpRequest request;
+    HttpClientMode mode;
+    unsigned long queue_time;
+  };
+  class HostQueue {
+  public:
+    HostQueue();
+
+    unsigned int connections;
+    std::deque<QueuedRequest> requests[kHttpPriorityCount];
+    bool scheduled[kHttpPriorityCount];
+  };
+
+  HttpPriority GetPriority(HttpClientMode mode) const;
+  int SelectPriority();
+  void ScheduleHost(HostQueue& host);
 
   void AddToQueue(HttpRequest& request, HttpClientMode mode);
   void ProcessQueue();
+  bool RemoveFromQueue(base::uid_t uid, QueuedRequest& queued);
+  void ReportCancel(const HttpRequest& request, HttpClientMode mode);
+  void ReportSend(const HttpRequest& request, HttpClientMode mode);
   void AddConnection(const string_t& hostname);
   void FreeConnection(const string_t& hostname);
 
-  std::list<HttpClient> clients_;
-  std::map<std::wstring, unsigned int> connections_;
+  std::list<PooledClient> clients_;
+  std::multimap<std::wstring, PooledClient*> clients_by_host_;
+  std::map<std::wstring, PooledClient*> clients_by_uid_;
+  unsigned int connections_;
   win::CriticalSection critical_section_;
-  std::vector<std::pair<HttpRequest, HttpClientMode>> requests_;
+  std::map<std::wstring, HostHealth> host_health_;
+  std::map<std::wstring, HostQueue> hosts_;
+  std::map<std::wstring, InFlightRequest> in_flight_;
+  std::map<std::wstring, std::wstring> in_flight_keys_;
+  unsigned int priority_credits_[kHttpPriorityCount];
+  QueueStats queue_stats_[kHttpPriorityCount];
+  std::deque<HostQueue*> ready_hosts_[kHttpPriorityCount];
 };
 
 }  // namespace taiga
@@ -0,0 +1,339 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <set>
+
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/http.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "base/xml.h"
+#include "taiga/http_cache.h"
+#include "taiga/path.h"
+
+namespace taiga {
+
+const QWORD kDefaultHttpCacheBudget = 32 * 1024 * 1024;  // 32 MiB
+
+static std::wstring GetHeaderValue(const base::http::header_t& header,
+                                   const std::wstring& name) {
+  foreach_c_(it, header)
+    if (IsEqual(it->first, name))
+      return it->second;
+
+  return std::wstring();
+}
+
+static std::wstring GetIndexPath() {
+  return GetPath(kPathCacheHttp) + L"index.xml";
+}
+
+HttpCache::Entry::Entry()
+    : external(false), last_access(0), size(0) {
+}
+
+HttpCache::HttpCache()
+    : hits(0),
+      misses(0),
+      revalidations(0),
+      budget_(kDefaultHttpCacheBudget),
+      loaded_(false),
+      next_file_id_(0),
+      size_(0) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void HttpCache::AddValidators(HttpRequest& request) {
+  win::Lock lock(critical_section_);
+
+  if (!IsEqual(request.method, L"GET"))
+    return;
+
+  Load();
+
+  auto it = entries_.find(request.url.Build());
+  if (it == entries_.end()) {
+    misses++;
+    return;
+  }
+
+  const Entry& entry = it->second;
+  if (!entry.etag.empty())
+    request.header[L"If-None-Match"] = entry.etag;
+  if (!entry.last_modified.empty())
+    request.header[L"If-Modified-Since"] = entry.last_modified;
+
+  revalidations++;
+}
+
+bool HttpCache::Restore(const HttpRequest& request, std::string& body) {
+  win::Lock lock(critical_section_);
+
+  Load();
+
+  auto it = entries_.find(request.url.Build());
+  if (it == entries_.end())
+    return false;
+
+  if (!ReadFromFile(GetFilePath(it->second), body)) {
+    LOG(LevelWarning, L"Could not read cached response for: " + it->first);
+    RemoveEntry(it);
+    return false;
+  }
+
+  it->second.last_access = time(nullptr);
+  hits++;
+
+  return true;
+}
+
+void HttpCache::Store(const HttpRequest& request,
+                      const HttpResponse& response,
+                      const std::string& body,
+                      const std::wstring& external_file) {
+  win::Lock lock(critical_section_);
+
+  if (!IsEqual(request.method, L"GET"))
+    return;
+
+  Load();
+
+  std::wstring url = request.url.Build();
+  std::wstring etag = GetHeaderValue(response.header, L"ETag");
+  std::wstring last_modified = GetHeaderValue(response.header, L"Last-Modified");
+
+  auto it = entries_.find(url);
+
+  // Without a validator, there is no way to make the next request conditional
+  if ((etag.empty() && last_modified.empty()) ||
+      (external_file.empty() && body.size() > budget_)) {
+    if (it != entries_.end())
+      RemoveEntry(it);
+    return;
+  }
+
+  if (it != entries_.end() && it->second.external != !external_file.empty()) {
+    RemoveEntry(it);
+    it = entries_.end();
+  }
+
+  if (it == entries_.end()) {
+    it = entries_.insert(std::make_pair(url, Entry())).first;
+    if (external_file.empty()) {
+      it->second.file =
+          ToWstr(static_cast<ULONG>(next_file_id_++)) + L".cache";
+    } else {
+      it->second.external = true;
+      it->second.file = external_file;
+    }
+  } else if (!it->second.external) {
+    size_ -= it->second.size;
+  }
+
+  Entry& entry = it->second;
+  entry.etag = etag;
+  entry.last_access = time(nullptr);
+  entry.last_modified = last_modified;
+
+  // External files don't count towards the budget, as they would be kept
+  // without the cache anyway
+  if (entry.external) {
+    entry.file = external_file;
+    return;
+  }
+
+  entry.size = body.size();
+
+  CreateFolder(GetPath(kPathCacheHttp));
+  if (!SaveToFile(body, GetFilePath(entry))) {
+    entry.size = 0;
+    RemoveEntry(it);
+    return;
+  }
+
+  size_ += entry.size;
+
+  Evict();
+}
+
+void HttpCache::Remove(const HttpRequest& request) {
+  win::Lock lock(critical_section_);
+
+  Load();
+
+  auto it = entries_.find(request.url.Build());
+  if (it != entries_.end())
+    RemoveEntry(it);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void HttpCache::Clear() {
+  win::Lock lock(critical_section_);
+
+  DeleteFolder(GetPath(kPathCacheHttp));
+
+  entries_.clear();
+  loaded_ = true;
+  next_file_id_ = 0;
+  size_ = 0;
+}
+
+bool HttpCache::Save() {
+  win::Lock lock(critical_section_);
+
+  if (!loaded_)
+    return false;
+
+  xml_document document;
+  xml_node node_cache = document.append_child(L"http_cache");
+  node_cache.append_attribute(L"next_file_id") = next_file_id_;
+
+  foreach_c_(it, entries_) {
+    const Entry& entry = it->second;
+    xml_node node = node_cache.append_child(L"entry");
+    node.append_attribute(L"url") = it->first.c_str();
+    node.append_attribute(L"file") = entry.file.c_str();
+    if (entry.external)
+      node.append_attribute(L"external") = true;
+    node.append_attribute(L"etag") = entry.etag.c_str();
+    node.append_attribute(L"last_modified") = entry.last_modified.c_str();
+    node.append_attribute(L"size") = ToWstr(entry.size).c_str();
+    node.append_attribute(L"last_access") =
+        ToWstr(static_cast<INT64>(entry.last_access)).c_str();
+  }
+
+  return XmlWriteDocumentToFile(document, GetIndexPath());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+QWORD HttpCache::budget() const {
+  return budget_;
+}
+
+QWORD HttpCache::size() const {
+  return size_;
+}
+
+void HttpCache::set_budget(QWORD budget) {
+  win::Lock lock(critical_section_);
+
+  budget_ = budget;
+  Evict();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void HttpCache::Evict() {
+  while (size_ > budget_) {
+    auto oldest = entries_.end();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it)
+      if (!it->second.external && (oldest == entries_.end() ||
+          it->second.last_access < oldest->second.last_access))
+        oldest = it;
+    if (oldest == entries_.end())
+      break;
+    LOG(LevelDebug, L"Evicting: " + oldest->first);
+    RemoveEntry(oldest);
+  }
+}
+
+std::wstring HttpCache::GetFilePath(const Entry& entry) const {
+  if (entry.external)
+    return entry.file;
+
+  return GetPath(kPathCacheHttp) + entry.file;
+}
+
+void HttpCache::Load() {
+  if (loaded_)
+    return;
+
+  loaded_ = true;
+
+  xml_document document;
+  std::wstring path = GetIndexPath();
+  xml_parse_result parse_result = document.load_file(path.c_str());
+
+  if (parse_result.status != pugi::status_ok) {
+    DeleteUnindexedFiles();
+    return;
+  }
+
+  xml_node node_cache = document.child(L"http_cache");
+  next_file_id_ = node_cache.attribute(L"next_file_id").as_uint();
+
+  foreach_xmlnode_(node, node_cache, L"entry") {
+    Entry entry;
+    entry.external = node.attribute(L"external").as_bool();
+    entry.file = node.attribute(L"file").value();
+    entry.etag = node.attribute(L"etag").value();
+    entry.last_modified = node.attribute(L"last_modified").value();
+    entry.last_access = _wtoi64(node.attribute(L"last_access").value());
+
+    // Files may have been removed in the meantime
+    QWORD size = GetFileSize(GetFilePath(entry));
+    if (!size)
+      continue;
+    if (!entry.external)
+      entry.size = size;
+
+    entries_[node.attribute(L"url").value()] = entry;
+    size_ += entry.size;
+  }
+
+  DeleteUnindexedFiles();
+  Evict();
+}
+
+void HttpCache::DeleteUnindexedFiles() {
+  // The index is only saved now and then, so files that were stored after it
+  // was last saved (e.g. before a crash) would otherwise be left behind
+  // without counting towards the budget
+  std::set<std::wstring> files;
+  foreach_c_(it, entries_)
+    if (!it->second.external)
+      files.insert(it->second.file);
+
+  std::wstring root = GetPath(kPathCacheHttp);
+  auto OnFile = [&](const std::wstring&, const std::wstring& name,
+                    const WIN32_FIND_DATA&) {
+    if (EndsWith(name, L".cache") && !files.count(name)) {
+      LOG(LevelDebug, L"Deleting unindexed file: " + name);
+      ::DeleteFile((root + name).c_str());
+    }
+    return false;
+  };
+
+  FileSearchHelper helper;
+  helper.set_skip_subdirectories(true);
+  helper.Search(root, nullptr, OnFile);
+}
+
+void HttpCache::RemoveEntry(std::map<std::wstring, Entry>::iterator it) {
+  // External files belong to someone else
+  if (!it->second.external)
+    ::DeleteFile(GetFilePath(it->second).c_str());
+  size_ -= it->second.size;
+  entries_.erase(it);
+}
+
+}  // namespace taiga
\ No newline at end of file
@@ -0,0 +1,91 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_TAIGA_HTTP_CACHE_H
+#define TAIGA_TAIGA_HTTP_CACHE_H
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include "base/types.h"
+#include "win/win_thread.h"
+
+namespace taiga {
+
+// Keeps the bodies of cacheable responses on disk, along with their
+// validators (i.e. ETag and Last-Modified), so that the next request for the
+// same URL can be made conditional, and a "304 Not Modified" response can be
+// served from the cache. Least recently used entries are evicted when the
+// total size exceeds the budget.
+
+class HttpCache {
+public:
+  HttpCache();
+  ~HttpCache() {}
+
+  void AddValidators(HttpRequest& request);
+  bool Restore(const HttpRequest& request, std::string& body);
+  // The body can be left to its owner, if it is already kept in a file, in
+  // which case only the validators are stored
+  void Store(const HttpRequest& request, const HttpResponse& response,
+             const std::string& body,
+             const std::wstring& external_file = std::wstring());
+  void Remove(const HttpRequest& request);
+
+  void Clear();
+  bool Save();
+
+  QWORD budget() const;
+  QWORD size() const;
+  void set_budget(QWORD budget);
+
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int revalidations;
+
+private:
+  class Entry {
+  public:
+    Entry();
+
+    std::wstring etag;
+    bool external;
+    std::wstring file;
+    time_t last_access;
+    std::wstring last_modified;
+    QWORD size;
+  };
+
+  void DeleteUnindexedFiles();
+  void Evict();
+  std::wstring GetFilePath(const Entry& entry) const;
+  void Load();
+  void RemoveEntry(std::map<std::wstring, Entry>::iterator it);
+
+  QWORD budget_;
+  win::CriticalSection critical_section_;
+  std::map<std::wstring, Entry> entries_;
+  bool loaded_;
+  unsigned int next_file_id_;
+  QWORD size_;
+};
+
+}  // namespace taiga
+
+#endif  // TAIGA_TAIGA_HTTP_CACHE_H
\ No newline at end of file
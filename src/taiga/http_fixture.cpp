@@ -0,0 +1,173 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <vector>
+
+#include "base/crc.h"
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/gzip.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "taiga/http.h"
+#include "taiga/http_fixture.h"
+#include "taiga/path.h"
+
+namespace taiga {
+
+// Bodies are passed to the client in chunks of this size, as they would be
+// received from the network
+const size_t kReplayChunkSize = 16 * 1024;  // 16 KiB
+
+HttpFixture::HttpFixture()
+    : mode(kHttpFixtureOff),
+      bandwidth(0),
+      default_code(0),
+      failure_code(0),
+      failure_rate(0),
+      gzip(false),
+      latency(0),
+      missed(0),
+      recorded(0),
+      replayed(0) {
+}
+
+bool HttpFixture::Record(const HttpRequest& request,
+                         const HttpResponse& response,
+                         const std::string& body) {
+  std::wstring file = GetFilePath(request);
+
+  // The body is stored after it was decompressed, and redirections are not
+  // followed again on replay
+  std::string header =
+      "HTTP/1.1 " + ToStr(static_cast<int>(response.code)) + " Recorded\r\n";
+  foreach_c_(it, response.header) {
+    if (IsEqual(it->first, L"Content-Encoding") ||
+        IsEqual(it->first, L"Content-Length") ||
+        IsEqual(it->first, L"Location"))
+      continue;
+    header += WstrToStr(it->first + L": " + it->second) + "\r\n";
+  }
+
+  if (!SaveToFile(header, file + L".header") ||
+      !SaveToFile(body, file + L".body")) {
+    LOG(LevelError, L"Could not record response: " + file);
+    return false;
+  }
+
+  win::Lock lock(critical_section_);
+  recorded++;
+
+  return true;
+}
+
+CURLcode HttpFixture::Replay(HttpClient& client) {
+  std::wstring file = GetFilePath(client.request_);
+
+  std::string header;
+  std::string body;
+
+  if (ReadFromFile(file + L".header", header)) {
+    ReadFromFile(file + L".body", body);
+  } else if (default_code) {
+    header = "HTTP/1.1 " + ToStr(static_cast<int>(default_code)) +
+             " Default\r\n";
+    body = default_body;
+  } else {
+    LOG(LevelWarning, L"No recorded response for: " +
+                      client.request_.url.Build());
+    win::Lock lock(critical_section_);
+    missed++;
+    return CURLE_COULDNT_CONNECT;
+  }
+
+  if (latency)
+    ::Sleep(latency);
+
+  bool failure = false;
+  {
+    win::Lock lock(critical_section_);
+    failure = failure_rate > 0 &&
+              static_cast<unsigned int>(rand() % 100) < failure_rate;
+  }
+  if (failure) {
+    if (!failure_code)
+      return CURLE_COULDNT_CONNECT;
+    header = "HTTP/1.1 " + ToStr(static_cast<int>(failure_code)) +
+             " Injected\r\n";
+    body.clear();
+  }
+
+  std::wstring header_text = StrToWstr(header);
+
+  if (gzip && !body.empty() &&
+      InStr(header_text, L"Content-Encoding:", 0, true) == -1) {
+    std::string compressed;
+    if (GzipString(body, compressed)) {
+      std::swap(body, compressed);
+      header_text += L"Content-Encoding: gzip\r\n";
+    }
+  }
+
+  // From here on, the response goes through the same callbacks as it would if
+  // it was received by curl
+  std::vector<std::wstring> lines;
+  Split(header_text, L"\r\n", lines);
+  lines.push_back(L"");
+  foreach_(line, lines) {
+    if (line->empty() && line + 1 != lines.end())
+      continue;
+    std::string header_line = WstrToStr(*line) + "\r\n";
+    size_t size = HttpClient::HeaderFunction(&header_line[0], 1,
+                                             header_line.size(), &client);
+    if (size != header_line.size())
+      return CURLE_WRITE_ERROR;
+  }
+
+  for (size_t pos = 0; pos < body.size(); pos += kReplayChunkSize) {
+    size_t size = min(kReplayChunkSize, body.size() - pos);
+    if (HttpClient::WriteFunction(&body[pos], 1, size, &client) != size)
+      return CURLE_WRITE_ERROR;
+    if (bandwidth)
+      ::Sleep(static_cast<DWORD>(size * 1000 / bandwidth));
+    if (client.ProgressFunction(static_cast<curl_off_t>(body.size()),
+                                static_cast<curl_off_t>(pos + size)))
+      return CURLE_ABORTED_BY_CALLBACK;
+  }
+
+  win::Lock lock(critical_section_);
+  replayed++;
+
+  return CURLE_OK;
+}
+
+std::wstring HttpFixture::GetFilePath(const HttpRequest& request) {
+  win::Lock lock(critical_section_);
+
+  if (path.empty())
+    path = GetPath(kPathTest) + L"http\\";
+  CreateFolder(path);
+
+  std::wstring key = request.method + L" " + request.url.Build() + L" " +
+                     CalculateCrcFromString(request.body);
+
+  return path + CalculateCrcFromString(key);
+}
+
+}  // namespace taiga
\ No newline at end of file
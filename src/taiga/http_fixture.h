@@ -0,0 +1,90 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_TAIGA_HTTP_FIXTURE_H
+#define TAIGA_TAIGA_HTTP_FIXTURE_H
+
+#include <string>
+
+#include "base/http.h"
+#include "base/types.h"
+#include "win/win_thread.h"
+
+namespace taiga {
+
+enum HttpFixtureMode {
+  kHttpFixtureOff,
+  kHttpFixtureRecord,
+  kHttpFixtureReplay
+};
+
+class HttpClient;
+
+// The fixture stands in for remote servers. It records responses to disk,
+// then replays them in place of the network, so that services, managers and
+// parsers run unmodified against a known set of data. Replayed responses can
+// be slowed down, compressed or replaced with failures.
+//
+// Rather than a local server, this is an interceptor within the process:
+// HttpClient::Transfer() passes replayed responses to curl's callbacks on a
+// thread of the client's own. curl, the transport, the share handle and
+// sockets are never used while replaying, so the fixture times our own code
+// but not the network stack. It is a part of the Windows build, like the
+// rest of the client.
+
+class HttpFixture {
+public:
+  HttpFixture();
+  ~HttpFixture() {}
+
+  bool Record(const HttpRequest& request, const HttpResponse& response,
+              const std::string& body);
+  CURLcode Replay(HttpClient& client);
+
+  HttpFixtureMode mode;
+  // Defaults to the "http" folder under the test path
+  std::wstring path;
+
+  // In bytes per second, or 0 for no limit
+  unsigned int bandwidth;
+  // Status code of injected failures, or 0 for a connection error
+  unsigned int failure_code;
+  // Percentage of requests to fail
+  unsigned int failure_rate;
+  // Served for requests that have no recorded response, if the code is set,
+  // e.g. to stand in for a service that acknowledges every update
+  unsigned int default_code;
+  std::string default_body;
+  // Compresses bodies that were not received as such
+  bool gzip;
+  // In milliseconds
+  unsigned int latency;
+
+  unsigned int missed;
+  unsigned int recorded;
+  unsigned int replayed;
+
+private:
+  std::wstring GetFilePath(const HttpRequest& request);
+
+  win::CriticalSection critical_section_;
+};
+
+}  // namespace taiga
+
+#endif  // TAIGA_TAIGA_HTTP_FIXTURE_H
\ No newline at end of file
@@ -0,0 +1,193 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "base/foreach.h"
+#include "base/string.h"
+#include "taiga/http_stats.h"
+
+taiga::HttpStats HttpStatistics;
+
+namespace taiga {
+
+static const wchar_t* kHttpPhaseNames[kHttpPhaseCount] = {
+  L"Name lookup",
+  L"Connect",
+  L"TLS handshake",
+  L"First byte",
+  L"Transfer",
+  L"Processing",
+  L"Total"
+};
+
+static QWORD ToMicroseconds(double seconds) {
+  return seconds > 0.0 ? static_cast<QWORD>(seconds * 1000000.0) : 0;
+}
+
+static QWORD GetElapsedMicroseconds(const LARGE_INTEGER& start) {
+  LARGE_INTEGER frequency, now;
+  if (!::QueryPerformanceFrequency(&frequency) || !frequency.QuadPart)
+    return 0;
+  ::QueryPerformanceCounter(&now);
+
+  return static_cast<QWORD>((now.QuadPart - start.QuadPart) * 1000000 /
+                            frequency.QuadPart);
+}
+
+HttpTimings::HttpTimings()
+    : throughput(0) {
+  for (int i = 0; i < kHttpPhaseCount; i++)
+    phases[i] = 0;
+  processing_start_.QuadPart = 0;
+}
+
+void HttpTimings::ReadTransferInfo(const HttpClient& client) {
+  // Each time that curl reports is measured from the start of the transfer.
+  // Phases that were skipped (e.g. a reused connection) are reported as 0.
+  double name_lookup = client.GetTransferInfo(CURLINFO_NAMELOOKUP_TIME);
+  double connect = client.GetTransferInfo(CURLINFO_CONNECT_TIME);
+  double app_connect = client.GetTransferInfo(CURLINFO_APPCONNECT_TIME);
+  double start_transfer = client.GetTransferInfo(CURLINFO_STARTTRANSFER_TIME);
+  double total = client.GetTransferInfo(CURLINFO_TOTAL_TIME);
+
+  double established = max(name_lookup, max(connect, app_connect));
+
+  phases[kHttpPhaseNameLookup] = ToMicroseconds(name_lookup);
+  phases[kHttpPhaseConnect] = ToMicroseconds(connect - name_lookup);
+  phases[kHttpPhaseTlsHandshake] = ToMicroseconds(app_connect - connect);
+  phases[kHttpPhaseFirstByte] = ToMicroseconds(start_transfer - established);
+  phases[kHttpPhaseTransfer] = ToMicroseconds(total - start_transfer);
+  phases[kHttpPhaseTotal] = ToMicroseconds(total);
+
+  throughput = static_cast<QWORD>(
+      client.GetTransferInfo(CURLINFO_SPEED_DOWNLOAD));
+}
+
+void HttpTimings::StartProcessing() {
+  ::QueryPerformanceCounter(&processing_start_);
+}
+
+void HttpTimings::StopProcessing() {
+  phases[kHttpPhaseProcessing] = GetElapsedMicroseconds(processing_start_);
+  phases[kHttpPhaseTotal] += phases[kHttpPhaseProcessing];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+HttpStats::Entry::Entry()
+    : cancellations(0), failures(0) {
+}
+
+void HttpStats::Record(HttpClientMode mode, const std::wstring& host,
+                       const HttpTimings& timings, CURLcode result) {
+  win::Lock lock(critical_section_);
+
+  Entry* entries[] = {&modes_[mode], &hosts_[host]};
+
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < kHttpPhaseCount; j++)
+      entries[i]->phases[j].Record(timings.phases[j]);
+    if (timings.throughput)
+      entries[i]->throughput.Record(timings.throughput);
+    if (result == CURLE_ABORTED_BY_CALLBACK) {
+      entries[i]->cancellations++;
+    } else if (result != CURLE_OK) {
+      entries[i]->failures++;
+    }
+  }
+}
+
+bool HttpStats::GetEntry(HttpClientMode mode, Entry& entry) {
+  win::Lock lock(critical_section_);
+
+  auto it = modes_.find(mode);
+  if (it == modes_.end())
+    return false;
+
+  entry = it->second;
+  return true;
+}
+
+bool HttpStats::GetEntry(const std::wstring& host, Entry& entry) {
+  win::Lock lock(critical_section_);
+
+  auto it = hosts_.find(host);
+  if (it == hosts_.end())
+    return false;
+
+  entry = it->second;
+  return true;
+}
+
+void HttpStats::Clear() {
+  win::Lock lock(critical_section_);
+
+  hosts_.clear();
+  modes_.clear();
+}
+
+static std::wstring DumpEntry(const HttpStats::Entry& entry) {
+  std::wstring text;
+
+  if (entry.failures || entry.cancellations) {
+    text += L"  " + PadChar(L"Unfinished", L' ', 14) + L"  " +
+            ToWstr(static_cast<int>(entry.failures)) + L" failed, " +
+            ToWstr(static_cast<int>(entry.cancellations)) + L" cancelled\r\n";
+  }
+
+  for (int i = 0; i < kHttpPhaseCount; i++) {
+    const Histogram& histogram = entry.phases[i];
+    text += L"  " + PadChar(kHttpPhaseNames[i], L' ', 14) + L"  p50 " +
+            ToWstr(histogram.GetPercentile(50.0) / 1000.0, 2) + L" ms, p90 " +
+            ToWstr(histogram.GetPercentile(90.0) / 1000.0, 2) + L" ms, p99 " +
+            ToWstr(histogram.GetPercentile(99.0) / 1000.0, 2) + L" ms, max " +
+            ToWstr(histogram.highest() / 1000.0, 2) + L" ms\r\n";
+  }
+
+  const Histogram& throughput = entry.throughput;
+  if (throughput.count()) {
+    text += L"  " + PadChar(L"Throughput", L' ', 14) + L"  p50 " +
+            ToWstr(throughput.GetPercentile(50.0) / 1024.0, 2) +
+            L" KB/s, p10 " +
+            ToWstr(throughput.GetPercentile(10.0) / 1024.0, 2) +
+            L" KB/s, min " +
+            ToWstr(throughput.lowest() / 1024.0, 2) + L" KB/s\r\n";
+  }
+
+  return text;
+}
+
+std::wstring HttpStats::Dump() {
+  win::Lock lock(critical_section_);
+
+  std::wstring text;
+
+  foreach_c_(it, modes_) {
+    text += L"Mode " + ToWstr(static_cast<int>(it->first)) + L" (" +
+            ToWstr(it->second.phases[kHttpPhaseTotal].count()) +
+            L" transfers)\r\n" + DumpEntry(it->second);
+  }
+  foreach_c_(it, hosts_) {
+    text += L"Host " + it->first + L" (" +
+            ToWstr(it->second.phases[kHttpPhaseTotal].count()) +
+            L" transfers)\r\n" + DumpEntry(it->second);
+  }
+
+  return text;
+}
+
+}  // namespace taiga
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_TAIGA_HTTP_STATS_H
+#define TAIGA_TAIGA_HTTP_STATS_H
+
+#include <map>
+#include <string>
+
+#include "base/histogram.h"
+#include "base/types.h"
+#include "taiga/http.h"
+#include "win/win_thread.h"
+
+namespace taiga {
+
+enum HttpPhase {
+  kHttpPhaseNameLookup,
+  kHttpPhaseConnect,
+  kHttpPhaseTlsHandshake,
+  kHttpPhaseFirstByte,
+  kHttpPhaseTransfer,
+  kHttpPhaseProcessing,
+  kHttpPhaseTotal,
+  kHttpPhaseCount
+};
+
+// Durations of each phase of a single transfer, in microseconds. The network
+// phases are taken from curl, while processing is the time that our own
+// handler took. Total covers everything from the start of the transfer until
+// the response was handled.
+class HttpTimings {
+public:
+  HttpTimings();
+
+  void ReadTransferInfo(const HttpClient& client);
+  void StartProcessing();
+  void StopProcessing();
+
+  QWORD phases[kHttpPhaseCount];
+  // In bytes per second
+  QWORD throughput;
+
+private:
+  LARGE_INTEGER processing_start_;
+};
+
+// Keeps histograms of transfer timings per client mode and per host, so that
+// a regression in any phase can be told apart from the others. Transfers that
+// failed or were cancelled are included, as they are often the slowest ones.
+class HttpStats {
+public:
+  class Entry {
+  public:
+    Entry();
+
+    Histogram phases[kHttpPhaseCount];
+    Histogram throughput;
+    unsigned int cancellations;
+    unsigned int failures;
+  };
+
+  void Record(HttpClientMode mode, const std::wstring& host,
+              const HttpTimings& timings, CURLcode result = CURLE_OK);
+
+  bool GetEntry(HttpClientMode mode, Entry& entry);
+  bool GetEntry(const std::wstring& host, Entry& entry);
+
+  void Clear();
+  std::wstring Dump();
+
+private:
+  win::CriticalSection critical_section_;
+  std::map<std::wstring, Entry> hosts_;
+  std::map<HttpClientMode, Entry> modes_;
+};
+
+}  // namespace taiga
+
+extern taiga::HttpStats HttpStatistics;
+
+#endif  // TAIGA_TAIGA_HTTP_STATS_H
\ No newline at end of file
@@ -52,10 +52,14 @@ std::wstring GetPath(PathType type) {
     default:
     case kPathData:
       return data_path;
+    case kPathCacheHttp:
+      return data_path + L"cache\\http\\";
     case kPathDatabase:
       return data_path + L"db\\";
     case kPathDatabaseAnime:
       return data_path + L"db\\anime.xml";
+    case kPathDatabaseAnimeIds:
+      return data_path + L"db\\anime_ids.xml";
     case kPathDatabaseImage:
       return data_path + L"db\\image\\";
     case kPathDatabaseSeason:
@@ -80,6 +84,8 @@ std::wstring GetPath(PathType type) {
       return data_path + L"user\\";
     case kPathUserHistory:
       return data_path + L"user\\" + GetUserDirectoryName() + L"\\history.xml";
+    case kPathUserHistoryLog:
+      return data_path + L"user\\" + GetUserDirectoryName() + L"\\history.dat";
     case kPathUserLibrary:
       return data_path + L"user\\" + GetUserDirectoryName() + L"\\anime.xml";
   }
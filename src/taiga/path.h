@@ -24,9 +24,11 @@
 namespace taiga {
 
 enum PathType {
+  kPathCacheHttp,
   kPathData,
   kPathDatabase,
   kPathDatabaseAnime,
+  kPathDatabaseAnimeIds,
   kPathDatabaseImage,
   kPathDatabaseSeason,
   kPathFeed,
@@ -39,6 +41,7 @@ enum PathType {
   kPathThemeCurrent,
   kPathUser,
   kPathUserHistory,
+  kPathUserHistoryLog,
   kPathUserLibrary
 };
 
@@ -371,6 +371,10 @@ void AppSettings::ApplyChanges(const std::wstring& previous_service,
 
   bool changed_username = GetCurrentUsername() != previous_user;
   if (changed_username || changed_service) {
+    // Responses to requests made for the previous account must not be applied
+    // to the new one
+    ServiceManager.CancelRequests(
+        ServiceManager.GetServiceIdByName(previous_service));
     AnimeDatabase.LoadList();
     History.Load();
     CurrentEpisode.Set(anime::ID_UNKNOWN);
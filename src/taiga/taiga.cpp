@@ -24,6 +24,7 @@
 #include "taiga/announce.h"
 #include "taiga/api.h"
 #include "taiga/dummy.h"
+#include "taiga/http.h"
 #include "taiga/resource.h"
 #include "taiga/settings.h"
 #include "taiga/taiga.h"
@@ -141,6 +142,14 @@ void App::ParseCommandLineArguments() {
     } else if (argument == L"-allowmultipleinstances") {
       allow_multiple_instances = true;
       LOG(LevelDebug, argument);
+    // Responses are saved to, or served from, the "http" folder under the
+    // test path, so that performance can be measured without the network
+    } else if (argument == L"-recordhttp") {
+      ConnectionManager.fixture.mode = taiga::kHttpFixtureRecord;
+      LOG(LevelDebug, argument);
+    } else if (argument == L"-replayhttp") {
+      ConnectionManager.fixture.mode = taiga::kHttpFixtureReplay;
+      LOG(LevelDebug, argument);
     } else {
       LOG(LevelWarning, L"Invalid argument: " + argument);
     }
@@ -24,6 +24,8 @@
 #include "library/anime_util.h"
 #include "library/history.h"
 #include "library/resource.h"
+#include "sync/manager.h"
+#include "sync/prefetch.h"
 #include "taiga/announce.h"
 #include "taiga/http.h"
 #include "taiga/settings.h"
@@ -154,6 +156,9 @@ void TimerManager::UpdateUi() {
 
 void TimerManager::OnTick() {
   MediaPlayers.CheckRunningPlayers();
+  History.queue.CheckRetries();
+  ServiceManager.CheckTimeouts();
+  MetadataPrefetcher.Tick();
   Stats.uptime++;
 
   UpdateEnabledState();
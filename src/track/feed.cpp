@@ -188,6 +188,17 @@ std::wstring Feed::GetDataPath() {
   return path;
 }
 
+std::wstring Feed::GetDownloadPath() {
+  if (download_index < 0 ||
+      download_index >= static_cast<int>(items.size()))
+    return std::wstring();
+
+  std::wstring file = items.at(download_index).title;
+  ValidateFileName(file);
+
+  return GetDataPath() + file + L".torrent";
+}
+
 bool Feed::Load() {
   std::wstring file = GetDataPath() + L"feed.xml";
   items.clear();
@@ -289,18 +300,15 @@ void Aggregator::HandleFeedCheck(Feed& feed, const std::string& data,
   }
 }
 
-void Aggregator::HandleFeedDownload(Feed& feed, const std::string& data,
-                                    bool download_all) {
+void Aggregator::HandleFeedDownload(Feed& feed, bool download_all) {
   auto feed_item = reinterpret_cast<FeedItem*>(&feed.items.at(feed.download_index));
 
+  // The file has already been written as it was being downloaded
+  std::wstring file = feed.GetDownloadPath();
+
   feed_item->state = kFeedItemDiscardedNormal;
   feed.download_index = -1;
 
-  std::wstring file = feed_item->title;
-  ValidateFileName(file);
-  file = feed.GetDataPath() + file + L".torrent";
-  SaveToFile(data, file);
-
   if (!FileExists(file)) {
     ui::OnFeedDownload(false, L"Torrent file doesn't exist");
     return;
@@ -393,7 +401,9 @@ bool Aggregator::ValidateFeedDownload(const HttpRequest& http_request,
     }
   }
 
-  if (StartsWith(http_response.body, L"<!DOCTYPE html>")) {
+  // Downloads are validated before they are written over the previous file,
+  // in which case the body holds only the beginning of the file
+  if (StartsWith(StrToWstr(http_response.body), L"<!DOCTYPE html>")) {
     auto location = http_request.url.Build();
     ui::OnFeedDownload(false, L"Invalid torrent file: " + location);
     return false;
@@ -117,6 +117,7 @@ public:
   bool Download(int index);
   bool ExamineData();
   std::wstring GetDataPath();
+  std::wstring GetDownloadPath();
   bool Load();
 
   FeedCategory category;
@@ -133,7 +134,7 @@ public:
   Feed* Get(FeedCategory category);
 
   void HandleFeedCheck(Feed& feed, const std::string& data, bool automatic);
-  void HandleFeedDownload(Feed& feed, const std::string& data, bool download_all);
+  void HandleFeedDownload(Feed& feed, bool download_all);
   bool ValidateFeedDownload(const HttpRequest& http_request, HttpResponse& http_response);
 
   bool Notify(const Feed& feed);
@@ -16,6 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <limits>
+#include <set>
+
 #include "base/foreach.h"
 #include "base/string.h"
 #include "library/anime_db.h"
@@ -508,25 +511,30 @@ void AnimeDialog::Refresh(bool image, bool series_info, bool my_info, bool conne
 
     // Recently watched
     std::vector<int> anime_ids;
+    std::set<int> anime_ids_seen;
     foreach_cr_(it, History.queue.items) {
-      if (it->episode &&
-          std::find(anime_ids.begin(), anime_ids.end(), it->anime_id) == anime_ids.end()) {
+      if (it->episode && anime_ids_seen.insert(it->anime_id).second) {
         auto anime_item = AnimeDatabase.FindItem(it->anime_id);
         if (anime_item->GetMyStatus() != anime::kCompleted ||
             anime_item->GetMyScore() == 0)
           anime_ids.push_back(it->anime_id);
       }
     }
-    foreach_cr_(it, History.items) {
-      if (it->episode &&
-          std::find(anime_ids.begin(), anime_ids.end(), it->anime_id) == anime_ids.end()) {
-        auto anime_item = AnimeDatabase.FindItem(it->anime_id);
+    const size_t kRecentlyWatchedLimit = 20;
+    // History is read from the newest item, and only until we have enough to
+    // show, as the rest would be cut off anyway
+    for (size_t i = History.items.size();
+         i > 0 && anime_ids.size() < kRecentlyWatchedLimit; i--) {
+      const HistoryItem& history_item = History.items.at(i - 1);
+      if (history_item.episode &&
+          anime_ids_seen.insert(history_item.anime_id).second) {
+        auto anime_item = AnimeDatabase.FindItem(history_item.anime_id);
         if (anime_item->GetMyStatus() != anime::kCompleted ||
             anime_item->GetMyScore() == 0)
-          anime_ids.push_back(it->anime_id);
+          anime_ids.push_back(history_item.anime_id);
       }
     }
-    int recently_watched = 0;
+    size_t recently_watched = 0;
     foreach_c_(it, anime_ids) {
       auto anime_item = AnimeDatabase.FindItem(*it);
       content += L"  \u2022 " + anime_item->GetTitle();
@@ -542,7 +550,7 @@ void AnimeDialog::Refresh(bool image, bool series_info, bool my_info, bool conne
       }
       content += L"\n";
       recently_watched++;
-      if (recently_watched >= 20)
+      if (recently_watched >= kRecentlyWatchedLimit)
         break;
     }
     if (content.empty()) {
@@ -552,20 +560,15 @@ void AnimeDialog::Refresh(bool image, bool series_info, bool my_info, bool conne
     } else {
       content = L"Recently watched:\n" + content + L"\n";
       int watched_last_week = 0;
+      time_t time_limit = time(nullptr) - day_limit * 60 * 60 * 24;
       foreach_c_(it, History.queue.items) {
         if (!it->episode || *it->episode == 0)
           continue;
-        date_diff = date_now - (Date)(it->time.substr(0, 10));
-        if (date_diff <= day_limit)
-          watched_last_week++;
-      }
-      foreach_c_(it, History.items) {
-        if (!it->episode || *it->episode == 0)
-          continue;
-        date_diff = date_now - (Date)(it->time.substr(0, 10));
-        if (date_diff <= day_limit)
+        if (it->time >= time_limit)
           watched_last_week++;
       }
+      watched_last_week += static_cast<int>(History.log.CountItems(
+          time_limit, (std::numeric_limits<time_t>::max)()));
       if (watched_last_week > 0)
         content += L"You've watched " + ToWstr(watched_last_week) + L" episodes in the last week.\n\n";
     }
@@ -21,6 +21,7 @@
 #include "library/anime_db.h"
 #include "library/anime_util.h"
 #include "library/history.h"
+#include "sync/prefetch.h"
 #include "sync/sync.h"
 #include "taiga/resource.h"
 #include "taiga/settings.h"
@@ -179,6 +180,8 @@ void PageSeriesInfo::Refresh(int anime_id, bool connect) {
   text = anime_item->GetSynopsis();
   SetDlgItemText(IDC_EDIT_ANIME_SYNOPSIS, text.c_str());
 
+  MetadataPrefetcher.OnViewed(anime_id_);
+
   // Get new data if necessary
   if (connect && anime::MetadataNeedsRefresh(*anime_item)) {
     parent->UpdateTitle(true);
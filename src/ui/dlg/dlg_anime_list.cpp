@@ -162,7 +162,10 @@ INT_PTR AnimeListDialog::DialogProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM
         if (tab_index > -1) {
           int status = tab.GetItemParam(tab_index);
           if (anime_item->IsInList()) {
-            ExecuteAction(L"EditStatus(" + ToWstr(status) + L")", 0, anime_id);
+            std::vector<int> anime_ids;
+            GetSelectedIds(anime_ids);
+            ExecuteAction(L"EditStatus(" + ToWstr(status) + L")",
+                          reinterpret_cast<WPARAM>(&anime_ids), anime_id);
           } else {
             AnimeDatabase.AddToList(anime_id, status);
           }
@@ -519,6 +522,12 @@ LRESULT AnimeListDialog::OnListNotify(LPARAM lParam) {
     case LVN_ITEMCHANGED: {
       auto lplv = reinterpret_cast<LPNMLISTVIEW>(lParam);
       auto anime_id = static_cast<int>(lplv->lParam);
+      if (!(lplv->uNewState & LVIS_SELECTED) && anime_id == current_id_ &&
+          listview.GetSelectedCount() > 0) {
+        // Another item is still selected, so it becomes the current one
+        int index = listview.GetNextItem(-1, LVNI_SELECTED);
+        anime_id = static_cast<int>(listview.GetItemParam(index));
+      }
       SetCurrentId(anime_id);
       if (lplv->uNewState)
         listview.RefreshItem(lplv->iItem);
@@ -604,17 +613,20 @@ LRESULT AnimeListDialog::OnListNotify(LPARAM lParam) {
         if (listview.GetSelectedCount() > 0) {
           int anime_id = GetCurrentId();
           auto anime_item = GetCurrentItem();
+          std::vector<int> anime_ids;
+          GetSelectedIds(anime_ids);
+          auto selection = reinterpret_cast<WPARAM>(&anime_ids);
           ui::Menus.UpdateAll(anime_item);
           int index = listview.HitTest(true);
           if (anime_item->IsInList()) {
             switch (index) {
               // Score
               case 2:
-                ExecuteAction(ui::Menus.Show(DlgMain.GetWindowHandle(), 0, 0, L"EditScore"), 0, anime_id);
+                ExecuteAction(ui::Menus.Show(DlgMain.GetWindowHandle(), 0, 0, L"EditScore"), selection, anime_id);
                 break;
               // Other
               default:
-                ExecuteAction(ui::Menus.Show(DlgMain.GetWindowHandle(), 0, 0, L"RightClick"), 0, anime_id);
+                ExecuteAction(ui::Menus.Show(DlgMain.GetWindowHandle(), 0, 0, L"RightClick"), selection, anime_id);
                 break;
             }
             ui::Menus.UpdateAll(anime_item);
@@ -684,7 +696,10 @@ LRESULT AnimeListDialog::OnListNotify(LPARAM lParam) {
             listview.GetSubItemRect(item_index, 0, &rect);
             POINT pt = {rect.left, rect.bottom};
             ::ClientToScreen(listview.GetWindowHandle(), &pt);
-            ExecuteAction(ui::Menus.Show(DlgMain.GetWindowHandle(), pt.x, pt.y, L"RightClick"), 0, anime_id);
+            std::vector<int> anime_ids;
+            GetSelectedIds(anime_ids);
+            ExecuteAction(ui::Menus.Show(DlgMain.GetWindowHandle(), pt.x, pt.y, L"RightClick"),
+                          reinterpret_cast<WPARAM>(&anime_ids), anime_id);
           }
           break;
         }
@@ -1087,6 +1102,17 @@ int AnimeListDialog::GetListIndex(int anime_id) {
   return -1;
 }
 
+void AnimeListDialog::GetSelectedIds(std::vector<int>& anime_ids) {
+  anime_ids.clear();
+
+  if (!IsWindow())
+    return;
+
+  int index = -1;
+  while ((index = listview.GetNextItem(index, LVNI_SELECTED)) > -1)
+    anime_ids.push_back(static_cast<int>(listview.GetItemParam(index)));
+}
+
 void AnimeListDialog::RefreshList(int index) {
   if (!IsWindow())
     return;
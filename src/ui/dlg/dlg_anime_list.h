@@ -19,6 +19,8 @@
 #ifndef TAIGA_UI_DLG_ANIME_LIST_H
 #define TAIGA_UI_DLG_ANIME_LIST_H
 
+#include <vector>
+
 #include "win/ctrl/win_ctrl.h"
 #include "win/win_dialog.h"
 #include "win/win_gdi.h"
@@ -46,6 +48,7 @@ public:
   anime::Item* GetCurrentItem();
   void SetCurrentId(int anime_id);
   int GetListIndex(int anime_id);
+  void GetSelectedIds(std::vector<int>& anime_ids);
   void RefreshList(int index = -1);
   void RefreshListItem(int anime_id);
   void RefreshTabs(int index = -1);
@@ -210,22 +210,26 @@ void HistoryDialog::RefreshList() {
                      AnimeDatabase.FindItem(it->anime_id)->GetTitle().c_str(),
                      static_cast<LPARAM>(it->anime_id));
     list_.SetItem(i, 1, details.c_str());
-    list_.SetItem(i, 2, it->time.c_str());
+    list_.SetItem(i, 2, ToDateTimeString(it->time).c_str());
   }
 
   // Add recently watched
-  foreach_cr_(it, History.items) {
+  std::vector<const HistoryItem*> history_items;
+  History.items.GetRecentItems(History.items.size(), history_items);
+  foreach_c_(it, history_items) {
+    const HistoryItem& history_item = **it;
     int i = list_.GetItemCount();
-    auto anime_item = AnimeDatabase.FindItem(it->anime_id);
+    auto anime_item = AnimeDatabase.FindItem(history_item.anime_id);
     int icon = StatusToIcon(anime_item->GetAiringStatus());
     std::wstring details;
-    AppendString(details, L"Episode: " + anime::TranslateNumber(*it->episode));
+    AppendString(details,
+                 L"Episode: " + anime::TranslateNumber(*history_item.episode));
 
     list_.InsertItem(i, 1, icon, 0, nullptr,
                      anime_item->GetTitle().c_str(),
-                     static_cast<LPARAM>(it->anime_id));
+                     static_cast<LPARAM>(history_item.anime_id));
     list_.SetItem(i, 1, details.c_str());
-    list_.SetItem(i, 2, it->time.c_str());
+    list_.SetItem(i, 2, ToDateTimeString(history_item.time).c_str());
   }
 
   // Redraw
@@ -267,6 +271,7 @@ bool HistoryDialog::MoveItems(int pos) {
                    History.queue.items.begin() + j + pos);
     item_selected_new.at(j + pos) = true;
   }
+  History.queue.RebuildIndex();
 
   RefreshList();
   for (size_t i = 0; i < item_selected_new.size(); i++)
@@ -292,7 +297,7 @@ bool HistoryDialog::RemoveItems() {
       } else {
         item_index -= History.queue.items.size();
         item_index = History.items.size() - item_index - 1;
-        History.items.erase(History.items.begin() + item_index);
+        History.RemoveItem(item_index);
       }
     }
     History.Save();
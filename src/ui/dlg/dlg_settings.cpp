@@ -508,7 +508,7 @@ void SettingsDialog::RefreshCache() {
   SettingsPage& page = pages[kSettingsPageLibraryCache];
 
   // History
-  text = ToWstr(static_cast<int>(History.items.size())) + L" item(s)";
+  text = ToWstr(static_cast<int>(History.log.records().size())) + L" item(s)";
   page.SetDlgItemText(IDC_STATIC_CACHE1, text.c_str());
 
   // Image files
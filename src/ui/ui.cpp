@@ -89,8 +89,8 @@ void DisplayErrorMessage(const std::wstring& text,
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void OnHttpError(const taiga::HttpClient& http_client, const string_t& error) {
-  switch (http_client.mode()) {
+void OnHttpError(taiga::HttpClientMode mode, const string_t& error) {
+  switch (mode) {
     case taiga::kHttpSilent:
     case taiga::kHttpServiceGetMetadataById:
     case taiga::kHttpServiceGetMetadataByIdV2:
@@ -261,6 +261,29 @@ void OnLibraryEntryChange(int id) {
     DlgSeason.RefreshList(true);
 }
 
+void OnLibraryEntriesChange(const std::vector<int>& ids) {
+  if (ids.size() == 1) {
+    OnLibraryEntryChange(ids.front());
+    return;
+  }
+
+  foreach_c_(it, ids) {
+    if (DlgAnime.GetCurrentId() == *it)
+      DlgAnime.Refresh(false, true, false, false);
+    if (DlgNowPlaying.GetCurrentId() == *it)
+      DlgNowPlaying.Refresh(false, true, false, false);
+  }
+
+  // Refreshing the whole list once is cheaper than refreshing each item
+  if (DlgAnimeList.IsWindow()) {
+    DlgAnimeList.RefreshList();
+    DlgAnimeList.RefreshTabs();
+  }
+
+  if (DlgSeason.IsWindow())
+    DlgSeason.RefreshList(true);
+}
+
 void OnLibraryEntryDelete(int id) {
   if (DlgAnime.GetCurrentId() == id)
     DlgAnime.Destroy();
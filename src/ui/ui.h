@@ -40,7 +40,7 @@ int StatusToIcon(int status);
 
 void DisplayErrorMessage(const std::wstring& text, const std::wstring& caption);
 
-void OnHttpError(const taiga::HttpClient& http_client, const string_t& error);
+void OnHttpError(taiga::HttpClientMode mode, const string_t& error);
 void OnHttpHeadersAvailable(const taiga::HttpClient& http_client);
 void OnHttpProgress(const taiga::HttpClient& http_client);
 void OnHttpReadComplete(const taiga::HttpClient& http_client);
@@ -49,6 +49,7 @@ void OnLibraryChange();
 void OnLibraryChangeFailure();
 void OnLibraryEntryAdd(int id);
 void OnLibraryEntryChange(int id);
+void OnLibraryEntriesChange(const std::vector<int>& ids);
 void OnLibraryEntryDelete(int id);
 void OnLibraryEntryImageChange(int id);
 void OnLibrarySearchTitle(int id, const string_t& results);